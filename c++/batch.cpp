@@ -0,0 +1,464 @@
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include "batch.hpp"
+#include "cache.hpp"
+#include "file.hpp"
+#include "node.hpp"
+#include "parallel.hpp"
+#include "parser.hpp"
+#include "pool.hpp"
+#include "sink.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+#ifndef _WIN32
+#include <glob.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Files bigger than this are split across the pool rather than left to one worker
+static const size_t splitSize = 1024 * 1024;
+
+static bool isMarkdown(const fs::path& path) {
+    return path.extension() == ".md" || path.extension() == ".markdown";
+}
+
+static bool isPattern(const std::string& input) {
+    std::error_code error;
+    return input.find_first_of("*?[") != std::string::npos && !fs::exists(input, error);
+}
+
+bool isBatchInput(const std::string& input) {
+    std::error_code error;
+    return fs::is_directory(input, error) || isPattern(input);
+}
+
+static std::string outputPath(const fs::path& input, const fs::path& relative, const std::string& outputDir) {
+    fs::path output = outputDir.empty() ? input : fs::path(outputDir) / relative;
+    output.replace_extension(".html");
+    return output.string();
+}
+
+// Where a file named on its own goes under the output directory: at its
+// relative path if that stays inside, otherwise at the top
+static fs::path placement(const fs::path& input) {
+    fs::path normal = input.lexically_normal();
+    if (normal.is_absolute() || normal.empty() || *normal.begin() == "..") {
+        return input.filename();
+    }
+    return normal;
+}
+
+static bool addInput(const std::string& input, const std::string& outputDir, std::vector<BatchJob>& jobs) {
+    std::error_code error;
+    if (fs::is_directory(input, error)) {
+        std::vector<fs::path> files;
+        fs::recursive_directory_iterator it(input, error), end;
+        for (; !error && it != end; it.increment(error)) {
+            if (it->is_regular_file(error) && isMarkdown(it->path())) {
+                files.push_back(it->path());
+            }
+        }
+        if (error) {
+            std::cerr << "error reading directory " << input << std::endl;
+            return false;
+        }
+        std::sort(files.begin(), files.end());
+        for (const fs::path& file : files) {
+            jobs.push_back(BatchJob{file.string(), outputPath(file, file.lexically_relative(input), outputDir)});
+        }
+        return true;
+    }
+#ifndef _WIN32
+    if (isPattern(input)) {
+        glob_t matches;
+        if (glob(input.c_str(), 0, nullptr, &matches) != 0) {
+            std::cerr << "no files match " << input << std::endl;
+            return false;
+        }
+        bool ok = true;
+        for (size_t i = 0; i < matches.gl_pathc; i++) {
+            ok = addInput(matches.gl_pathv[i], outputDir, jobs) && ok;
+        }
+        globfree(&matches);
+        return ok;
+    }
+#endif
+    jobs.push_back(BatchJob{input, outputPath(input, placement(input), outputDir)});
+    return true;
+}
+
+// A path as it is compared against others: absolute and normalised, since
+// the file may not exist yet
+static std::string pathKey(const std::string& path) {
+    std::error_code error;
+    return fs::absolute(path, error).lexically_normal().string();
+}
+
+// True if `first` and `second` name the same file, as writing an input that
+// already ends in .html would
+static bool sameFile(const std::string& first, const std::string& second) {
+    std::error_code error;
+    return fs::equivalent(first, second, error) || pathKey(first) == pathKey(second);
+}
+
+// Fails, naming both, if two different inputs would write the same output
+// or one would write over another's input. The same input named twice is
+// given one output, which it is converted to once.
+static bool checkOutputs(std::vector<BatchJob>& jobs) {
+    bool ok = true;
+    std::unordered_map<std::string, size_t> inputs;
+    std::unordered_map<std::string, size_t> outputs;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        inputs.emplace(pathKey(jobs[i].input), i);
+    }
+    for (size_t i = 0; i < jobs.size(); i++) {
+        BatchJob& job = jobs[i];
+        std::string key = pathKey(job.output);
+        auto read = inputs.find(key);
+        if (read != inputs.end()) {
+            std::cerr << job.input << ": output " << job.output << " would overwrite input " << jobs[read->second].input << std::endl;
+            ok = false;
+            continue;
+        }
+        auto claimed = outputs.emplace(key, i);
+        if (claimed.second) {
+            continue;
+        }
+        const BatchJob& first = jobs[claimed.first->second];
+        if (sameFile(first.input, job.input)) {
+            job.output = first.output;
+        } else {
+            std::cerr << job.input << ": output " << job.output << " is also the output of " << first.input << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool collectJobs(const std::vector<std::string>& inputs, const std::string& fileList, const std::string& outputDir, std::vector<BatchJob>& jobs) {
+    bool ok = true;
+    for (const std::string& input : inputs) {
+        ok = addInput(input, outputDir, jobs) && ok;
+    }
+    if (!fileList.empty()) {
+        std::ifstream file;
+        if (fileList != "-") {
+            file.open(fileList);
+            if (!file) {
+                std::cerr << "error reading file list " << fileList << std::endl;
+                return false;
+            }
+        }
+        std::istream& list = fileList == "-" ? std::cin : file;
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty()) {
+                ok = addInput(line, outputDir, jobs) && ok;
+            }
+        }
+    }
+    // Nothing has been opened yet, so there's still time to move the output
+    // aside rather than truncate the input it would land on, and to refuse
+    // to let two inputs share one
+    for (BatchJob& job : jobs) {
+        if (sameFile(job.input, job.output)) {
+            job.output += ".html";
+        }
+    }
+    return checkOutputs(jobs) && ok;
+}
+
+namespace {
+
+// What each worker keeps from one file to the next
+struct Worker {
+    Document document;
+    FdSink file;
+    Stats idle;
+    TimedSink timed;
+    OutputBuffer out;
+
+    Worker() : timed(file, idle), out(timed) {}
+};
+
+// A file being converted piece by piece. Whichever worker renders the last
+// piece stitches them together and writes the output.
+struct SplitFile {
+    const BatchJob* job;
+    CacheKey key;
+    std::unique_ptr<MappedFile> input;
+    ParallelConverter converter;
+    std::atomic<size_t> remaining;
+};
+
+// The first job seen with a given key. It converts its input; later jobs
+// with the same bytes wait here for it to finish and then copy its output.
+struct Claim {
+    const BatchJob* owner;
+    bool done = false;
+    // Why the owner failed, if it did, to be reported for each copy too
+    std::string error;
+    std::vector<const BatchJob*> copies;
+};
+
+std::string describe(const Diagnostic& diagnostic) {
+    std::ostringstream message;
+    printDiagnostic(message, diagnostic);
+    std::string text = message.str();
+    if (!text.empty() && text.back() == '\n') {
+        text.pop_back();
+    }
+    return text;
+}
+
+class Batch {
+public:
+    explicit Batch(const BatchOptions& options)
+        : pool(options.threads), limits(options.limits), anchors(options.anchors || options.toc), toc(options.toc),
+          splitting(!limits.wholeDocument() && !anchors), cache(options.cacheDirectory), caching(!options.cacheDirectory.empty()), failures(0) {
+        for (unsigned i = 0; i < pool.size(); i++) {
+            workers.emplace_back(new Worker());
+            workers.back()->document.setLimits(limits);
+            workers.back()->document.setAnchors(anchors);
+        }
+    }
+
+    size_t run(const std::vector<BatchJob>& jobs, std::vector<Stats>* stats) {
+        for (size_t i = 0; i < jobs.size(); i++) {
+            const BatchJob& job = jobs[i];
+            Stats* jobStats = stats ? &(*stats)[i] : nullptr;
+            pool.submit([this, &job, jobStats](unsigned worker) {
+                // Heap use is counted per thread, so start from this one's
+                Stats local;
+                Stats& stats = jobStats ? *jobStats : local;
+                local.hardware = stats.hardware;
+                stats = local;
+                TraceSpan span("document", job.input);
+                convert(job, *workers[worker], stats, jobStats != nullptr);
+                stats.stop();
+            });
+        }
+        pool.wait();
+        return failures;
+    }
+
+private:
+    void convert(const BatchJob& job, Worker& worker, Stats& stats, bool counting) {
+        stats.enter(Phase::Read);
+        std::unique_ptr<MappedFile> input(new MappedFile());
+        if (!input->open(job.input)) {
+            fail(job, "error reading input file");
+            return;
+        }
+        CacheKey key = cacheKey(input->data(), limits, anchors);
+        if (!claim(job, key, input->data())) {
+            return;
+        }
+        if (caching) {
+            CachedTree cached;
+            if (cache.load(key, input->data(), cached)) {
+                settle(job, key, write(job, worker, stats, [&](OutputBuffer& out) { writePage(out, cached.tree()); }));
+                if (counting) {
+                    stats.inputBytes = input->data().length();
+                    stats.count(cached.tree());
+                    stats.outputBytes = worker.out.written();
+                }
+                return;
+            }
+        }
+        // Only whole-document trees are cached, so a big file that misses
+        // is still split for speed and just isn't stored
+        if (splitting && !counting && pool.size() > 1 && input->data().length() > splitSize) {
+            split(job, key, std::move(input));
+            return;
+        }
+
+        stats.enter(Phase::Tokenize);
+        Parser parser(input->data(), worker.document);
+        stats.enter(Phase::Parse);
+        const Document& document = parser.parseDocument();
+        if (!document.diagnostics().empty()) {
+            settle(job, key, describe(document.diagnostics().front()));
+            return;
+        }
+        std::string error = write(job, worker, stats, [&](OutputBuffer& out) { writePage(out, document.tree()); });
+        if (caching && !cache.store(key, document.tree())) {
+            warn(job, "error writing to cache");
+        }
+        settle(job, key, error);
+        if (counting) {
+            stats.inputBytes = input->data().length();
+            stats.tokens = parser.tokensUsed();
+            stats.count(document.tree());
+            stats.outputBytes = worker.out.written();
+        }
+    }
+
+    void split(const BatchJob& job, const CacheKey& key, std::unique_ptr<MappedFile> input) {
+        std::shared_ptr<SplitFile> file(new SplitFile());
+        file->job = &job;
+        file->key = key;
+        file->input = std::move(input);
+        size_t count = file->converter.split(file->input->data(), size_t(pool.size()) * 4);
+        file->remaining = count;
+        for (size_t i = 0; i < count; i++) {
+            pool.submit([this, file, i](unsigned worker) {
+                file->converter.render(i, workers[worker]->document);
+                if (--file->remaining == 0) {
+                    finish(*file, *workers[worker]);
+                }
+            });
+        }
+    }
+
+    void finish(SplitFile& file, Worker& worker) {
+        if (!file.converter.stitch(worker.document)) {
+            settle(*file.job, file.key, describe(file.converter.error()));
+            return;
+        }
+        settle(*file.job, file.key, write(*file.job, worker, worker.idle, [&](OutputBuffer& out) { file.converter.write(out); }));
+    }
+
+    void writePage(OutputBuffer& out, const Tree& tree) {
+        if (toc) {
+            writeTOC(out, tree);
+        }
+        writeHTML(out, tree);
+    }
+
+    // Returns why the output couldn't be written, or nothing if it was
+    template<typename Render>
+    std::string write(const BatchJob& job, Worker& worker, Stats& stats, Render render) {
+        stats.enter(Phase::Write);
+        std::error_code error;
+        fs::path parent = fs::path(job.output).parent_path();
+        if (!parent.empty()) {
+            fs::create_directories(parent, error);
+        }
+        worker.out.reset();
+        if (!worker.file.open(job.output)) {
+            return "error writing output file " + job.output;
+        }
+        worker.timed.retarget(stats);
+        stats.enter(Phase::Render);
+        render(worker.out);
+        bool ok = worker.out.flush();
+        stats.enter(Phase::Write);
+        worker.file.close();
+        return ok ? "" : "error writing output file " + job.output;
+    }
+
+    // True if `job` is the first with this input and should convert it.
+    // Otherwise it is copied from the first once that is done. A key is only
+    // a hash, so a match is checked against the first's bytes, which are
+    // mapped again since they may be long gone by now; a job whose bytes
+    // differ is converted on its own.
+    bool claim(const BatchJob& job, const CacheKey& key, std::string_view input) {
+        std::unique_lock<std::mutex> guard(claimLock);
+        Claim first;
+        first.owner = &job;
+        auto inserted = claims.emplace(key, first);
+        Claim& claim = inserted.first->second;
+        if (inserted.second) {
+            return true;
+        }
+        const BatchJob& owner = *claim.owner;
+        guard.unlock();
+        MappedFile original;
+        if (!original.open(owner.input) || original.data() != input) {
+            return true;
+        }
+        guard.lock();
+        if (!claim.done) {
+            claim.copies.push_back(&job);
+            return false;
+        }
+        std::string error = claim.error;
+        guard.unlock();
+        copy(owner, job, error);
+        return false;
+    }
+
+    // Records how the owner of `key` did, and gives copies their output.
+    // A job that only collided with the owner has nothing to record.
+    void settle(const BatchJob& job, const CacheKey& key, const std::string& error) {
+        if (!error.empty()) {
+            fail(job, error);
+        }
+        std::vector<const BatchJob*> copies;
+        {
+            std::lock_guard<std::mutex> guard(claimLock);
+            Claim& claim = claims.at(key);
+            if (claim.owner != &job) {
+                return;
+            }
+            claim.done = true;
+            claim.error = error;
+            copies.swap(claim.copies);
+        }
+        for (const BatchJob* copy : copies) {
+            this->copy(job, *copy, error);
+        }
+    }
+
+    void copy(const BatchJob& from, const BatchJob& to, const std::string& error) {
+        if (!error.empty()) {
+            fail(to, error);
+            return;
+        }
+        // The same file named twice
+        if (to.output == from.output) {
+            return;
+        }
+        std::error_code failed;
+        fs::path parent = fs::path(to.output).parent_path();
+        if (!parent.empty()) {
+            fs::create_directories(parent, failed);
+        }
+        if (!fs::copy_file(from.output, to.output, fs::copy_options::overwrite_existing, failed)) {
+            fail(to, "error writing output file " + to.output);
+        }
+    }
+
+    void fail(const BatchJob& job, const std::string& message) {
+        warn(job, message);
+        failures++;
+    }
+
+    void warn(const BatchJob& job, const std::string& message) {
+        std::lock_guard<std::mutex> guard(reportLock);
+        std::cerr << job.input << ": " << message << std::endl;
+    }
+
+    ThreadPool pool;
+    std::vector<std::unique_ptr<Worker>> workers;
+    Limits limits;
+    bool anchors;
+    bool toc;
+    bool splitting;
+    TreeCache cache;
+    bool caching;
+    std::mutex claimLock;
+    std::unordered_map<CacheKey, Claim, CacheKeyHash> claims;
+    std::mutex reportLock;
+    std::atomic<size_t> failures;
+};
+
+}
+
+size_t convertBatch(const std::vector<BatchJob>& jobs, const BatchOptions& options, std::vector<Stats>* stats) {
+    Batch batch(options);
+    return batch.run(jobs, stats);
+}
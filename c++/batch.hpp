@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "parser.hpp"
+#include "stats.hpp"
+
+// One file to convert and where its HTML goes
+struct BatchJob {
+    std::string input;
+    std::string output;
+};
+
+// True if `input` names a directory or a glob pattern rather than one file
+bool isBatchInput(const std::string& input);
+
+// Expands inputs into jobs. An input is a file, a directory (searched
+// recursively for .md files) or a glob pattern; `fileList`, unless empty,
+// names a file listing more inputs one per line (- for stdin). Each output
+// is the input path with an .html extension, under `outputDir` if one is
+// given; one that would be the input itself gets .html added instead.
+// Returns false, having said why, if an input can't be expanded or two
+// different inputs would be written to the same output.
+bool collectJobs(const std::vector<std::string>& inputs, const std::string& fileList, const std::string& outputDir, std::vector<BatchJob>& jobs);
+
+struct BatchOptions {
+    // Size of the pool; 0 for one per core
+    unsigned threads = 0;
+    // Each file is held to these
+    Limits limits;
+    // If not empty, trees are looked up in and added to a TreeCache there
+    std::string cacheDirectory;
+    // Give headers ids (see Document::setAnchors)
+    bool anchors = false;
+    // Start each file with its table of contents; implies anchors
+    bool toc = false;
+};
+
+// Converts every job on a work-stealing pool, splitting big files across
+// the pool. Failures are reported on stderr as they happen; returns how
+// many there were. Files with the same contents are converted once and the
+// output copied. If `stats` is given (sized to match `jobs`), each job's
+// stats are recorded there. Files aren't split if there are stats to time
+// on one thread, limits on the whole document, or anchors, which have to be
+// unique across it.
+size_t convertBatch(const std::vector<BatchJob>& jobs, const BatchOptions& options, std::vector<Stats>* stats = nullptr);
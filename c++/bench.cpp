@@ -0,0 +1,282 @@
+// To run: g++ -std=c++17 -O2 bench.cpp corpus.cpp parser.cpp node.cpp scan.cpp sink.cpp trace.cpp -o bench.exe && bench.exe
+// Times lexing (the Parser constructor), parseDocument and rendering on
+// synthetic corpora, and optionally checks the results against a baseline
+// saved by an earlier run with --json.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "corpus.hpp"
+#include "node.hpp"
+#include "parser.hpp"
+#include "sink.hpp"
+
+struct Options {
+    size_t size = 4 * 1024 * 1024;
+    int repetitions = 15;
+    uint64_t seed = 1;
+    std::vector<std::string> corpora;
+    std::string json;
+    std::string baseline;
+    // Percent slower than the baseline that counts as a regression
+    double threshold = 10;
+    std::string dump;
+};
+
+// Times of one phase on one corpus, in nanoseconds
+struct Result {
+    std::string corpus;
+    std::string phase;
+    size_t bytes;
+    std::vector<double> samples;
+
+    // Nearest-rank percentile
+    double percentile(double p) const {
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = size_t(std::ceil(p / 100 * sorted.size()));
+        return sorted[rank > 0 ? rank - 1 : 0];
+    }
+    double median() const { return percentile(50); }
+    double nsPerByte() const { return median() / bytes; }
+    double mbPerSecond() const { return bytes / median() * 1e3; }
+};
+
+static void usage() {
+    std::cerr << "usage: bench.exe [--size <bytes>[K|M|G]] [--reps <n>] [--seed <n>] [--corpus <kind>]..." << std::endl;
+    std::cerr << "                 [--json <path>] [--baseline <path> [--threshold <percent>]] [--dump <dir>]" << std::endl;
+    std::cerr << "  Corpora:";
+    for (const std::string& kind : corpusKinds()) {
+        std::cerr << " " << kind;
+    }
+    std::cerr << std::endl;
+    std::cerr << "  --json saves the results; --baseline compares against saved results and" << std::endl;
+    std::cerr << "  exits with 1 if any phase got slower by more than the threshold (default 10%)." << std::endl;
+    std::cerr << "  --dump writes the corpora to <dir>/<kind>.md instead of timing anything." << std::endl;
+}
+
+static bool parseSize(const std::string& text, size_t& size) {
+    char* end;
+    double value = strtod(text.c_str(), &end);
+    switch (*end) {
+    case 'K': case 'k': value *= 1024; end++; break;
+    case 'M': case 'm': value *= 1024 * 1024; end++; break;
+    case 'G': case 'g': value *= 1024 * 1024 * 1024; end++; break;
+    }
+    size = size_t(value);
+    return *end == '\0' && end != text.c_str() && value > 0;
+}
+
+static double since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs every phase on `text` once to warm up, then `repetitions` times
+static bool measure(const std::string& corpus, const std::string& text, int repetitions, std::vector<Result>& results) {
+    Result lex{corpus, "lex", text.size(), {}};
+    Result parse{corpus, "parse", text.size(), {}};
+    Result render{corpus, "render", text.size(), {}};
+    Document document;
+    NullSink sink;
+    OutputBuffer out(sink);
+    for (int i = -1; i < repetitions; i++) {
+        auto start = std::chrono::steady_clock::now();
+        Parser parser(text, document);
+        double lexed = since(start);
+
+        start = std::chrono::steady_clock::now();
+        parser.parseDocument();
+        double parsed = since(start);
+        if (!document.diagnostics().empty()) {
+            std::cerr << corpus << ": ";
+            printDiagnostic(std::cerr, document.diagnostics().front());
+            return false;
+        }
+
+        start = std::chrono::steady_clock::now();
+        writeHTML(out, document.tree());
+        out.flush();
+        double rendered = since(start);
+
+        if (i >= 0) {
+            lex.samples.push_back(lexed);
+            parse.samples.push_back(parsed);
+            render.samples.push_back(rendered);
+        }
+    }
+    results.push_back(lex);
+    results.push_back(parse);
+    results.push_back(render);
+    return true;
+}
+
+static void report(const std::vector<Result>& results) {
+    std::cout << std::left << std::setw(10) << "corpus" << std::setw(8) << "phase" << std::right
+              << std::setw(10) << "MB/s" << std::setw(10) << "ns/byte"
+              << std::setw(12) << "median ms" << std::setw(10) << "p90 ms" << std::setw(10) << "p99 ms" << std::endl;
+    for (const Result& result : results) {
+        std::cout << std::left << std::setw(10) << result.corpus << std::setw(8) << result.phase << std::right << std::fixed
+                  << std::setw(10) << std::setprecision(1) << result.mbPerSecond()
+                  << std::setw(10) << std::setprecision(3) << result.nsPerByte()
+                  << std::setw(12) << result.median() / 1e6
+                  << std::setw(10) << result.percentile(90) / 1e6
+                  << std::setw(10) << result.percentile(99) / 1e6 << std::endl;
+    }
+}
+
+static bool save(const std::string& path, const Options& options, const std::vector<Result>& results) {
+    std::ofstream out(path);
+    out << "{\n  \"size\": " << options.size << ",\n  \"repetitions\": " << options.repetitions
+        << ",\n  \"seed\": " << options.seed << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& result = results[i];
+        out << "    {\"corpus\": \"" << result.corpus << "\", \"phase\": \"" << result.phase << "\", \"bytes\": " << result.bytes
+            << ", \"median_ns\": " << std::fixed << std::setprecision(0) << result.median()
+            << ", \"p90_ns\": " << result.percentile(90) << ", \"p99_ns\": " << result.percentile(99)
+            << std::setprecision(3) << ", \"mb_per_s\": " << result.mbPerSecond()
+            << std::setprecision(4) << ", \"ns_per_byte\": " << result.nsPerByte() << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    return bool(out);
+}
+
+// Reads "key": value out of one flat JSON object written by save()
+static std::string field(const std::string& object, const std::string& key) {
+    size_t at = object.find("\"" + key + "\"");
+    if (at == std::string::npos) {
+        return "";
+    }
+    at = object.find(':', at) + 1;
+    while (at < object.size() && (object[at] == ' ' || object[at] == '"')) {
+        at++;
+    }
+    size_t end = object.find_first_of(",\"}", at);
+    return object.substr(at, end - at);
+}
+
+// Compares against a baseline file and prints every phase that moved by
+// more than the threshold. Returns false if any got slower.
+static bool compare(const std::string& path, double threshold, const std::vector<Result>& results) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "error reading baseline " << path << std::endl;
+        return false;
+    }
+    std::stringstream contents;
+    contents << in.rdbuf();
+    std::string text = contents.str();
+
+    bool ok = true;
+    size_t matched = 0;
+    size_t at = text.find("\"results\"");
+    while (at != std::string::npos && (at = text.find('{', at)) != std::string::npos) {
+        size_t end = text.find('}', at);
+        std::string object = text.substr(at, end - at);
+        at = end;
+        std::string corpus = field(object, "corpus");
+        std::string phase = field(object, "phase");
+        double before = atof(field(object, "ns_per_byte").c_str());
+        for (const Result& result : results) {
+            if (result.corpus != corpus || result.phase != phase || before <= 0) {
+                continue;
+            }
+            matched++;
+            double change = (result.nsPerByte() / before - 1) * 100;
+            if (std::fabs(change) > threshold) {
+                std::cout << (change > 0 ? "REGRESSION " : "improvement ") << corpus << " " << phase << ": "
+                          << std::setprecision(3) << before << " -> " << result.nsPerByte() << " ns/byte ("
+                          << std::showpos << std::setprecision(1) << change << std::noshowpos << "%)" << std::endl;
+                ok = ok && change < 0;
+            }
+        }
+    }
+    if (matched == 0) {
+        std::cerr << "nothing in " << path << " matches these corpora" << std::endl;
+        return false;
+    }
+    if (ok) {
+        std::cout << "no regressions against " << path << " (" << matched << " phases)" << std::endl;
+    }
+    return ok;
+}
+
+auto main(int argc, char** argv)->int {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--size" && hasValue) {
+            if (!parseSize(argv[++i], options.size)) {
+                usage();
+                return 1;
+            }
+        } else if (arg == "--reps" && hasValue) {
+            options.repetitions = atoi(argv[++i]);
+        } else if (arg == "--seed" && hasValue) {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--corpus" && hasValue) {
+            options.corpora.push_back(argv[++i]);
+        } else if (arg == "--json" && hasValue) {
+            options.json = argv[++i];
+        } else if (arg == "--baseline" && hasValue) {
+            options.baseline = argv[++i];
+        } else if (arg == "--threshold" && hasValue) {
+            options.threshold = atof(argv[++i]);
+        } else if (arg == "--dump" && hasValue) {
+            options.dump = argv[++i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (options.corpora.empty()) {
+        options.corpora = corpusKinds();
+    }
+    if (options.repetitions < 1) {
+        usage();
+        return 1;
+    }
+
+    std::vector<Result> results;
+    std::string text;
+    for (const std::string& corpus : options.corpora) {
+        if (!generateCorpus(corpus, options.size, options.seed, text)) {
+            std::cerr << "unknown corpus " << corpus << std::endl;
+            usage();
+            return 1;
+        }
+        if (!options.dump.empty()) {
+            std::ofstream out(options.dump + "/" + corpus + ".md", std::ios::binary);
+            out << text;
+            if (!out) {
+                std::cerr << "error writing " << options.dump << "/" << corpus << ".md" << std::endl;
+                return 1;
+            }
+            continue;
+        }
+        if (!measure(corpus, text, options.repetitions, results)) {
+            return 1;
+        }
+    }
+    if (!options.dump.empty()) {
+        return 0;
+    }
+
+    report(results);
+    if (!options.json.empty() && !save(options.json, options, results)) {
+        std::cerr << "error writing " << options.json << std::endl;
+        return 1;
+    }
+    if (!options.baseline.empty() && !compare(options.baseline, options.threshold, results)) {
+        return 1;
+    }
+    return 0;
+}
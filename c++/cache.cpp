@@ -0,0 +1,207 @@
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include "cache.hpp"
+#include "sink.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// The xxHash64 algorithm: four lanes of multiply-rotate over 32 bytes at a
+// time, so hashing runs at memory speed and a hit costs next to nothing
+const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t prime3 = 0x165667B19E3779F9ULL;
+const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+uint64_t rotate(uint64_t x, int bits) {
+    return (x << bits) | (x >> (64 - bits));
+}
+
+uint64_t load64(const char* p) {
+    uint64_t value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+uint32_t load32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+uint64_t mix(uint64_t lane, uint64_t input) {
+    return rotate(lane + input * prime2, 31) * prime1;
+}
+
+uint64_t merge(uint64_t hash, uint64_t lane) {
+    return (hash ^ mix(0, lane)) * prime1 + prime4;
+}
+
+uint64_t hashBytes(const char* p, size_t length, uint64_t seed) {
+    const char* end = p + length;
+    uint64_t hash;
+    if (length >= 32) {
+        uint64_t lanes[4] = {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+        for (; end - p >= 32; p += 32) {
+            for (int i = 0; i < 4; i++) {
+                lanes[i] = mix(lanes[i], load64(p + 8 * i));
+            }
+        }
+        hash = rotate(lanes[0], 1) + rotate(lanes[1], 7) + rotate(lanes[2], 12) + rotate(lanes[3], 18);
+        for (uint64_t lane : lanes) {
+            hash = merge(hash, lane);
+        }
+    } else {
+        hash = seed + prime5;
+    }
+    hash += length;
+    for (; end - p >= 8; p += 8) {
+        hash = rotate(hash ^ mix(0, load64(p)), 27) * prime1 + prime4;
+    }
+    if (end - p >= 4) {
+        hash = rotate(hash ^ (load32(p) * prime1), 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash = rotate(hash ^ (uint8_t(*p) * prime5), 11) * prime1;
+    }
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    return hash ^ (hash >> 32);
+}
+
+// "MDT1" in little-endian order
+const uint32_t entryMagic = 0x3154444D;
+
+struct EntryHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nodeSize;
+    uint32_t nodeCount;
+    uint32_t blockCount;
+    uint32_t headingCount;
+    uint64_t hash;
+    uint64_t sourceLength;
+    uint64_t idsLength;
+};
+
+bool inside(const Span& span, size_t length) {
+    return span.offset <= length && span.length <= length - span.offset;
+}
+
+// Checks that walking and rendering the tree can't go outside the entry or
+// the source. Children and siblings always come later in pre-order, which
+// also rules out cycles.
+bool valid(const Node* nodes, size_t nodeCount, const uint32_t* blocks, size_t blockCount, const Heading* headings, size_t headingCount,
+        size_t idsLength, size_t sourceLength) {
+    for (size_t i = 0; i < nodeCount; i++) {
+        const Node& node = nodes[i];
+        if (size_t(node.kind) >= nodeKindCount || !inside(node.text, sourceLength) || !inside(node.url, sourceLength)) {
+            return false;
+        }
+        if (node.firstChild != NoNode && (node.firstChild <= i || node.firstChild >= nodeCount)) {
+            return false;
+        }
+        if (node.nextSibling != NoNode && (node.nextSibling <= i || node.nextSibling >= nodeCount)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < blockCount; i++) {
+        if (blocks[i] >= nodeCount) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < headingCount; i++) {
+        const Heading& heading = headings[i];
+        if (heading.node >= nodeCount || nodes[heading.node].kind != NodeKind::Header || !inside(heading.id, idsLength)
+                || (i > 0 && heading.node <= headings[i - 1].node)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Unique among every process and thread writing to the cache at once
+std::string temporarySuffix() {
+    static const uint64_t process = std::random_device()();
+    static std::atomic<uint64_t> count(0);
+    return ".tmp" + std::to_string(process) + "-" + std::to_string(count++);
+}
+
+}
+
+CacheKey cacheKey(std::string_view source, const Limits& limits, bool anchors) {
+    uint64_t build[] = {cacheVersion, sizeof(Node), limits.inputBytes, limits.tokens, limits.nodes, limits.nesting, anchors};
+    uint64_t seed = hashBytes(reinterpret_cast<const char*>(build), sizeof(build), 0);
+    return CacheKey{hashBytes(source.data(), source.length(), seed), source.length()};
+}
+
+std::string TreeCache::path(const CacheKey& key) const {
+    char name[48];
+    snprintf(name, sizeof(name), "%016llx-%llx.tree", (unsigned long long)key.hash, (unsigned long long)key.length);
+    return (fs::path(directory) / name).string();
+}
+
+bool TreeCache::load(const CacheKey& key, std::string_view source, CachedTree& entry) const {
+    if (!entry.file.open(path(key))) {
+        return false;
+    }
+    std::string_view data = entry.file.data();
+    EntryHeader header;
+    if (data.length() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    size_t nodeBytes = size_t(header.nodeCount) * sizeof(Node);
+    size_t blockBytes = size_t(header.blockCount) * sizeof(uint32_t);
+    size_t headingBytes = size_t(header.headingCount) * sizeof(Heading);
+    if (header.magic != entryMagic || header.version != cacheVersion || header.nodeSize != sizeof(Node) || header.hash != key.hash
+            || header.sourceLength != key.length || source.length() != key.length || header.idsLength > data.length()
+            || data.length() != sizeof(header) + nodeBytes + blockBytes + headingBytes + header.idsLength) {
+        return false;
+    }
+    // The header keeps the arrays 4-byte aligned, and mappings start on a page
+    const char* p = data.data() + sizeof(header);
+    const Node* nodes = reinterpret_cast<const Node*>(p);
+    const uint32_t* blocks = reinterpret_cast<const uint32_t*>(p + nodeBytes);
+    const Heading* headings = reinterpret_cast<const Heading*>(p + nodeBytes + blockBytes);
+    std::string_view ids(p + nodeBytes + blockBytes + headingBytes, header.idsLength);
+    if (!valid(nodes, header.nodeCount, blocks, header.blockCount, headings, header.headingCount, ids.length(), source.length())) {
+        return false;
+    }
+    entry.view = Tree{nodes, header.nodeCount, blocks, header.blockCount, source, headings, header.headingCount, ids};
+    return true;
+}
+
+bool TreeCache::store(const CacheKey& key, const Tree& tree) const {
+    std::error_code error;
+    fs::create_directories(directory, error);
+    std::string final = path(key);
+    std::string temporary = final + temporarySuffix();
+
+    EntryHeader header = {entryMagic, cacheVersion, uint32_t(sizeof(Node)), uint32_t(tree.nodeCount), uint32_t(tree.blockCount),
+        uint32_t(tree.headingCount), key.hash, key.length, tree.ids.length()};
+    FdSink file;
+    bool ok = file.open(temporary)
+        && file.write(reinterpret_cast<const char*>(&header), sizeof(header))
+        && file.write(reinterpret_cast<const char*>(tree.nodes), tree.nodeCount * sizeof(Node))
+        && file.write(reinterpret_cast<const char*>(tree.blocks), tree.blockCount * sizeof(uint32_t))
+        && file.write(reinterpret_cast<const char*>(tree.headings), tree.headingCount * sizeof(Heading))
+        && file.write(tree.ids.data(), tree.ids.length());
+    file.close();
+    if (ok) {
+        fs::rename(temporary, final, error);
+        ok = !error;
+    }
+    if (!ok) {
+        fs::remove(temporary, error);
+    }
+    return ok;
+}
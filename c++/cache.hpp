@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "file.hpp"
+#include "node.hpp"
+#include "parser.hpp"
+
+// Bump whenever a change to parsing or to Node means a tree cached by an
+// older build no longer matches what this one would parse
+constexpr uint32_t cacheVersion = 3;
+
+// Names an input by its contents, plus everything else that decides what it
+// parses to: the converter version, the limits and whether headers get
+// anchors. 64 bits of hash and the length, so a collision between different
+// inputs isn't checked for.
+struct CacheKey {
+    uint64_t hash;
+    uint64_t length;
+
+    bool operator==(const CacheKey& other) const { return hash == other.hash && length == other.length; }
+};
+
+struct CacheKeyHash {
+    size_t operator()(const CacheKey& key) const { return size_t(key.hash); }
+};
+
+CacheKey cacheKey(std::string_view source, const Limits& limits, bool anchors = false);
+
+// A tree read back from the cache. The file is mapped and the tree points
+// straight into it; its text is the source it was looked up with, which has
+// to outlive it.
+class CachedTree {
+public:
+    Tree tree() const { return view; }
+
+private:
+    friend class TreeCache;
+
+    MappedFile file;
+    Tree view = {};
+};
+
+// A directory of parsed trees named by CacheKey, so an input that hasn't
+// changed since it was last converted is rendered without parsing it again.
+// An entry is a header and then the Node, block and Heading arrays and the
+// ids as they are in memory; nodes refer to each other by index and to the
+// source by offset, so nothing needs fixing up after mapping. The source
+// isn't stored: the input has to be read to find the key anyway. Entries are
+// written to a temporary file and renamed into place, so any number of
+// processes can share a directory.
+class TreeCache {
+public:
+    explicit TreeCache(const std::string& directory) : directory(directory) {}
+
+    // Maps the entry for `source` into `entry`. False if there isn't one,
+    // or it is damaged or from another build.
+    bool load(const CacheKey& key, std::string_view source, CachedTree& entry) const;
+    bool store(const CacheKey& key, const Tree& tree) const;
+
+private:
+    std::string path(const CacheKey& key) const;
+
+    std::string directory;
+};
@@ -0,0 +1,501 @@
+// To run: g++ -std=c++17 -O2 compare.cpp corpus.cpp -o compare.exe && compare.exe
+// Builds every port of the converter whose toolchain is installed, runs each
+// on the same synthetic corpora at several sizes, and reports throughput,
+// peak RSS and startup time side by side, along with whether each port's
+// HTML matches the C++ port's once whitespace is normalised. Unix only:
+// runs are timed and measured with fork and wait4.
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "corpus.hpp"
+
+namespace fs = std::filesystem;
+
+// How to build and run one port. In `build` (a shell command, run in the
+// port's directory) and `run`, {bin} is the directory builds go to, {dir}
+// the port's directory and {input} the corpus. Every port writes
+// output.html to its working directory, and some read ../input.md whatever
+// they're given, so runs happen in <work>/run with the corpus at
+// <work>/input.md.
+struct Port {
+    std::string name;
+    std::string directory;
+    // Programs that have to be on the PATH, for building and running
+    std::vector<std::string> tools;
+    std::string build;
+    std::vector<std::string> run;
+};
+
+static const std::vector<Port> ports = {
+    {"c++", "c++", {"g++"},
+        "g++ -std=c++17 -O2 -pthread converter.cpp parser.cpp node.cpp file.cpp scan.cpp sink.cpp stream.cpp parallel.cpp pool.cpp batch.cpp "
+        "incremental.cpp watch.cpp stats.cpp counters.cpp trace.cpp convert.cpp daemon.cpp cache.cpp -o {bin}/c++.exe",
+        {"{bin}/c++.exe", "{input}"}},
+    {"c", "c", {"gcc"}, "gcc -O2 converter.c arena.c node.c output.c parser.c string.c token.c -o {bin}/c.exe", {"{bin}/c.exe", "{input}"}},
+    {"rust", "rust", {"cargo"}, "cargo build --release --quiet --target-dir {bin}/rust", {"{bin}/rust/release/rust", "{input}"}},
+    {"go", "go", {"go"}, "go build -o {bin}/go.exe .", {"{bin}/go.exe", "{input}"}},
+    {"zig", "zig", {"zig"}, "zig build-exe -O ReleaseFast src/main.zig -femit-bin={bin}/zig.exe", {"{bin}/zig.exe", "{input}"}},
+    {"nim", "nim", {"nim"}, "nim compile -d:release --hints:off --nimcache:{bin}/nim -o:{bin}/nim.exe converter.nim", {"{bin}/nim.exe", "--", "{input}"}},
+    {"haskell", "haskell", {"ghc"}, "ghc -O2 -v0 -outputdir {bin}/haskell -o {bin}/haskell.exe converter.hs", {"{bin}/haskell.exe", "{input}"}},
+    {"ocaml", "ocaml", {"ocamlopt"}, "cp converter.ml {bin}/ && cd {bin} && ocamlopt -O3 converter.ml -o ocaml.exe", {"{bin}/ocaml.exe", "{input}"}},
+    {"pascal", "pascal", {"fpc"}, "fpc -Mdelphi -O2 -v0 -FE{bin} -opascal.exe converter.pp", {"{bin}/pascal.exe", "{input}"}},
+    {"java", "java", {"javac", "java"}, "javac -d {bin}/java *.java", {"java", "-cp", "{bin}/java", "Converter", "{input}"}},
+    {"javascript", "javascript", {"node"}, "", {"node", "{dir}/converter.js", "{input}"}},
+    {"python", "python", {"python3"}, "", {"python3", "{dir}/converter.py", "{input}"}},
+    {"ruby", "ruby", {"ruby"}, "", {"ruby", "{dir}/converter.rb", "{input}"}},
+    {"php", "php", {"php"}, "", {"php", "{dir}/converter.php", "{input}"}},
+    {"julia", "julia", {"julia"}, "", {"julia", "{dir}/converter.jl", "{input}"}},
+    {"blade", "blade", {"blade"}, "", {"blade", "{dir}/converter.b", "{input}"}},
+};
+
+struct Options {
+    // The repository, with a directory per port
+    std::string root = "..";
+    std::string work = "compare.tmp";
+    std::vector<size_t> sizes;
+    int repetitions = 3;
+    uint64_t seed = 1;
+    std::vector<std::string> corpora;
+    std::vector<std::string> ports;
+    // Seconds of CPU a single run may take
+    int timeout = 60;
+};
+
+// One run of a port
+struct Run {
+    bool ok = false;
+    // Why it didn't work, if it didn't
+    std::string error;
+    double seconds = 0;
+    // Kilobytes
+    long peakRSS = 0;
+};
+
+// A port on one corpus at one size
+struct Cell {
+    std::string port;
+    std::string corpus;
+    size_t bytes;
+    std::vector<double> seconds;
+    long peakRSS = 0;
+    double startup = 0;
+    std::string status;
+
+    double median() const {
+        std::vector<double> sorted = seconds;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[(sorted.size() - 1) / 2];
+    }
+};
+
+static void usage() {
+    std::cerr << "usage: compare.exe [--root <dir>] [--work <dir>] [--size <bytes>[K|M|G]]... [--reps <n>] [--seed <n>]" << std::endl;
+    std::cerr << "                   [--corpus <kind>]... [--port <name>]... [--timeout <seconds>]" << std::endl;
+    std::cerr << "  Corpora:";
+    for (const std::string& kind : corpusKinds()) {
+        std::cerr << " " << kind;
+    }
+    std::cerr << std::endl << "  Ports:";
+    for (const Port& port : ports) {
+        std::cerr << " " << port.name;
+    }
+    std::cerr << std::endl;
+    std::cerr << "  --root is the repository (.. by default, to run from c++/); builds and runs" << std::endl;
+    std::cerr << "  happen under --work. Sizes default to 64K, 1M and 8M. Ports whose tools" << std::endl;
+    std::cerr << "  aren't installed are skipped. A run using more than --timeout seconds of" << std::endl;
+    std::cerr << "  CPU (60 by default) is killed and counted as failed." << std::endl;
+}
+
+static bool parseSize(const std::string& text, size_t& size) {
+    char* end;
+    double value = strtod(text.c_str(), &end);
+    switch (*end) {
+    case 'K': case 'k': value *= 1024; end++; break;
+    case 'M': case 'm': value *= 1024 * 1024; end++; break;
+    case 'G': case 'g': value *= 1024 * 1024 * 1024; end++; break;
+    }
+    size = size_t(value);
+    return *end == '\0' && end != text.c_str() && value > 0;
+}
+
+static std::string formatSize(size_t bytes) {
+    std::ostringstream text;
+    if (bytes >= 1024 * 1024 && bytes % (1024 * 1024) == 0) {
+        text << bytes / (1024 * 1024) << "M";
+    } else if (bytes >= 1024 && bytes % 1024 == 0) {
+        text << bytes / 1024 << "K";
+    } else {
+        text << bytes;
+    }
+    return text.str();
+}
+
+static bool onPath(const std::string& tool) {
+    const char* path = getenv("PATH");
+    std::istringstream directories(path ? path : "");
+    std::string directory;
+    while (std::getline(directories, directory, ':')) {
+        std::string candidate = (fs::path(directory.empty() ? "." : directory) / tool).string();
+        if (access(candidate.c_str(), X_OK) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string expand(std::string text, const std::string& bin, const std::string& dir, const std::string& input) {
+    const std::pair<const char*, const std::string*> names[] = {{"{bin}", &bin}, {"{dir}", &dir}, {"{input}", &input}};
+    for (const auto& name : names) {
+        for (size_t at = text.find(name.first); at != std::string::npos; at = text.find(name.first, at + name.second->length())) {
+            text.replace(at, strlen(name.first), *name.second);
+        }
+    }
+    return text;
+}
+
+static std::string quote(const std::string& text) {
+    std::string quoted = "'";
+    for (char c : text) {
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+// Runs `argv` in `directory` with output to `log`, and measures it
+static Run execute(const std::vector<std::string>& argv, const std::string& directory, const std::string& log, int timeout) {
+    Run run;
+    auto start = std::chrono::steady_clock::now();
+    pid_t child = fork();
+    if (child < 0) {
+        run.error = "fork failed";
+        return run;
+    }
+    if (child == 0) {
+        std::vector<char*> args;
+        for (const std::string& arg : argv) {
+            args.push_back(const_cast<char*>(arg.c_str()));
+        }
+        args.push_back(nullptr);
+        int output = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int nothing = open("/dev/null", O_RDONLY);
+        if (output < 0 || nothing < 0 || chdir(directory.c_str()) != 0) {
+            _exit(126);
+        }
+        dup2(nothing, 0);
+        dup2(output, 1);
+        dup2(output, 2);
+        // SIGXCPU at the soft limit, SIGKILL a second later if that's caught
+        rlimit cpu = {rlim_t(timeout), rlim_t(timeout) + 1};
+        setrlimit(RLIMIT_CPU, &cpu);
+        execvp(args[0], args.data());
+        _exit(127);
+    }
+    int status;
+    rusage usage;
+    while (wait4(child, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            run.error = "wait failed";
+            return run;
+        }
+    }
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+#ifdef __APPLE__
+    run.peakRSS = usage.ru_maxrss / 1024;
+#else
+    run.peakRSS = usage.ru_maxrss;
+#endif
+    if (WIFSIGNALED(status)) {
+        int signal = WTERMSIG(status);
+        run.error = signal == SIGXCPU ? "timed out" : "signal " + std::to_string(signal) + " (" + strsignal(signal) + ")";
+    } else if (WEXITSTATUS(status) != 0) {
+        run.error = "exit status " + std::to_string(WEXITSTATUS(status));
+    } else {
+        run.ok = true;
+    }
+    return run;
+}
+
+static bool readFile(const std::string& path, std::string& text) {
+    std::ifstream file(path, std::ios::binary);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    text = contents.str();
+    return bool(file);
+}
+
+static bool writeFile(const std::string& path, const std::string& text) {
+    std::ofstream file(path, std::ios::binary);
+    file << text;
+    return bool(file);
+}
+
+// Ports differ in the newlines they put between blocks and whether a file
+// ends with one, so runs of whitespace become a single space, and go
+// altogether next to a tag. Attributes are quoted either way, so single
+// quotes inside tags become double.
+static std::string normalise(const std::string& html) {
+    std::string out;
+    bool space = false;
+    bool tag = false;
+    for (char c : html) {
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            space = true;
+            continue;
+        }
+        if (space && !out.empty() && out.back() != '>' && c != '<') {
+            out += ' ';
+        }
+        space = false;
+        if (c == '<' || c == '>') {
+            tag = c == '<';
+        }
+        out += tag && c == '\'' ? '"' : c;
+    }
+    return out;
+}
+
+// Where two normalised outputs first differ, with a little context
+static std::string difference(const std::string& expected, const std::string& actual) {
+    size_t at = std::mismatch(expected.begin(), expected.end(), actual.begin(), actual.end()).first - expected.begin();
+    size_t from = at > 20 ? at - 20 : 0;
+    std::string excerpt = actual.substr(from, 40);
+    std::replace(excerpt.begin(), excerpt.end(), '\n', ' ');
+    return "differs at " + std::to_string(at) + ": ..." + excerpt + "...";
+}
+
+// Compares a port's output to the reference's, saved normalised at
+// `expected`. Neither is kept once it returns; see main.
+static std::string check(const std::string& expected, const std::string& output) {
+    std::string reference;
+    std::string actual;
+    if (!readFile(expected, reference) || !readFile(output, actual)) {
+        return "failed: no output.html";
+    }
+    actual = normalise(actual);
+    return actual == reference ? "same" : difference(reference, actual);
+}
+
+static void report(const std::vector<Cell>& cells) {
+    std::cout << std::left << std::setw(12) << "port" << std::setw(10) << "corpus" << std::right << std::setw(6) << "size"
+              << std::setw(10) << "MB/s" << std::setw(12) << "median ms" << std::setw(10) << "peak MB"
+              << std::setw(12) << "startup ms" << "  " << "output" << std::endl;
+    for (const Cell& cell : cells) {
+        std::cout << std::left << std::setw(12) << cell.port << std::setw(10) << cell.corpus << std::right
+                  << std::setw(6) << formatSize(cell.bytes) << std::fixed;
+        if (cell.seconds.empty()) {
+            std::cout << std::setw(10) << "-" << std::setw(12) << "-" << std::setw(10) << "-";
+        } else {
+            std::cout << std::setw(10) << std::setprecision(1) << cell.bytes / cell.median() / 1e6
+                      << std::setw(12) << std::setprecision(1) << cell.median() * 1e3
+                      << std::setw(10) << std::setprecision(1) << cell.peakRSS / 1024.0;
+        }
+        std::cout << std::setw(12) << std::setprecision(1) << cell.startup * 1e3 << "  " << cell.status << std::endl;
+    }
+}
+
+auto main(int argc, char** argv)->int {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--root" && hasValue) {
+            options.root = argv[++i];
+        } else if (arg == "--work" && hasValue) {
+            options.work = argv[++i];
+        } else if (arg == "--size" && hasValue) {
+            size_t size;
+            if (!parseSize(argv[++i], size)) {
+                usage();
+                return 1;
+            }
+            options.sizes.push_back(size);
+        } else if (arg == "--reps" && hasValue) {
+            options.repetitions = atoi(argv[++i]);
+        } else if (arg == "--seed" && hasValue) {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--corpus" && hasValue) {
+            options.corpora.push_back(argv[++i]);
+        } else if (arg == "--port" && hasValue) {
+            options.ports.push_back(argv[++i]);
+        } else if (arg == "--timeout" && hasValue) {
+            options.timeout = atoi(argv[++i]);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (options.sizes.empty()) {
+        options.sizes = {64 * 1024, 1024 * 1024, 8 * 1024 * 1024};
+    }
+    if (options.corpora.empty()) {
+        options.corpora = corpusKinds();
+    }
+    if (options.repetitions < 1 || options.timeout < 1) {
+        usage();
+        return 1;
+    }
+    for (const std::string& name : options.ports) {
+        if (std::none_of(ports.begin(), ports.end(), [&](const Port& port) { return port.name == name; })) {
+            std::cerr << "unknown port " << name << std::endl;
+            usage();
+            return 1;
+        }
+    }
+
+    std::error_code error;
+    fs::path root = fs::absolute(options.root, error);
+    fs::path work = fs::absolute(options.work, error);
+    std::string bin = (work / "bin").string();
+    std::string run = (work / "run").string();
+    std::string input = (work / "input.md").string();
+    std::string log = (work / "log.txt").string();
+    fs::create_directories(bin, error);
+    fs::create_directories(run, error);
+    if (error) {
+        std::cerr << "error creating " << options.work << std::endl;
+        return 1;
+    }
+
+    // Build whatever can be built. Failures are reported and the port left
+    // out, so one broken toolchain doesn't stop the comparison.
+    std::vector<const Port*> selected;
+    for (const Port& port : ports) {
+        if (!options.ports.empty() && std::find(options.ports.begin(), options.ports.end(), port.name) == options.ports.end()) {
+            continue;
+        }
+        auto missing = std::find_if_not(port.tools.begin(), port.tools.end(), onPath);
+        if (missing != port.tools.end()) {
+            std::cerr << port.name << ": skipped, no " << *missing << " on the PATH" << std::endl;
+            continue;
+        }
+        std::string dir = (root / port.directory).string();
+        if (!port.build.empty()) {
+            std::cerr << port.name << ": building" << std::endl;
+            Run built = execute({"/bin/sh", "-c", expand(port.build, quote(bin), quote(dir), "")}, dir, log, 600);
+            if (!built.ok) {
+                std::string output;
+                readFile(log, output);
+                std::cerr << port.name << ": build failed (" << built.error << ")" << std::endl << output;
+                continue;
+            }
+        }
+        selected.push_back(&port);
+    }
+    if (selected.empty()) {
+        std::cerr << "no ports to compare" << std::endl;
+        return 1;
+    }
+
+    // Startup: the median time to convert a one-line document
+    std::vector<double> startup(selected.size(), 0);
+    if (!writeFile(input, "# Hello\n")) {
+        std::cerr << "error writing " << input << std::endl;
+        return 1;
+    }
+    for (size_t p = 0; p < selected.size(); p++) {
+        std::vector<std::string> argv;
+        for (const std::string& arg : selected[p]->run) {
+            argv.push_back(expand(arg, bin, (root / selected[p]->directory).string(), input));
+        }
+        std::vector<double> times;
+        for (int i = 0; i < options.repetitions; i++) {
+            Run result = execute(argv, run, log, options.timeout);
+            if (result.ok) {
+                times.push_back(result.seconds);
+            }
+        }
+        std::sort(times.begin(), times.end());
+        startup[p] = times.empty() ? 0 : times[(times.size() - 1) / 2];
+    }
+
+    // A child's peak RSS starts from what its parent had resident when it
+    // forked, so nothing the size of a corpus or an output is held here
+    // while a port runs: the corpus is dropped once written, and outputs
+    // are compared on disk after the runs
+    std::string expected = (work / "expected.html").string();
+    std::string output = (fs::path(run) / "output.html").string();
+    std::vector<Cell> cells;
+    for (const std::string& corpus : options.corpora) {
+        for (size_t size : options.sizes) {
+            size_t bytes;
+            {
+                std::string text;
+                if (!generateCorpus(corpus, size, options.seed, text)) {
+                    std::cerr << "unknown corpus " << corpus << std::endl;
+                    usage();
+                    return 1;
+                }
+                if (!writeFile(input, text)) {
+                    std::cerr << "error writing " << input << std::endl;
+                    return 1;
+                }
+                bytes = text.size();
+            }
+#ifdef __GLIBC__
+            // Hand back what's free at the top of the heap too
+            malloc_trim(0);
+#endif
+            // The first port to succeed sets what the rest should produce,
+            // which is the C++ port unless it was left out
+            bool referenced = false;
+            for (size_t p = 0; p < selected.size(); p++) {
+                const Port& port = *selected[p];
+                std::cerr << port.name << ": " << corpus << " " << formatSize(size) << std::endl;
+                Cell cell{port.name, corpus, bytes, {}, 0, startup[p], ""};
+                std::vector<std::string> argv;
+                for (const std::string& arg : port.run) {
+                    argv.push_back(expand(arg, bin, (root / port.directory).string(), input));
+                }
+                for (int i = 0; i < options.repetitions; i++) {
+                    fs::remove(output, error);
+                    Run result = execute(argv, run, log, options.timeout);
+                    if (!result.ok) {
+                        cell.status = "failed: " + result.error;
+                        cell.seconds.clear();
+                        break;
+                    }
+                    cell.seconds.push_back(result.seconds);
+                    cell.peakRSS = std::max(cell.peakRSS, result.peakRSS);
+                }
+                if (cell.seconds.empty()) {
+                    // Failed
+                } else if (referenced) {
+                    cell.status = check(expected, output);
+                } else {
+                    std::string html;
+                    if (!readFile(output, html) || !writeFile(expected, normalise(html))) {
+                        cell.status = "failed: no output.html";
+                    } else {
+                        cell.status = "reference";
+                        referenced = true;
+                    }
+                }
+                if (cell.status.compare(0, 6, "failed") == 0) {
+                    cell.seconds.clear();
+                }
+                cells.push_back(cell);
+            }
+        }
+    }
+
+    report(cells);
+    return 0;
+}
@@ -0,0 +1,28 @@
+#include "convert.hpp"
+#include "node.hpp"
+
+bool Converter::convert(std::string_view input, Sink& sink, const ConvertOptions& options) {
+    bytes = 0;
+    document.setLimits(options.limits);
+    Parser parser(input, document);
+    parser.parseDocument();
+    if (!document.diagnostics().empty()) {
+        return false;
+    }
+    out.reset(sink);
+    writeHTML(out, document.tree());
+    bool ok = out.flush();
+    bytes = out.written();
+    // Not holding on to the caller's sink past the call
+    out.reset(idle);
+    return ok;
+}
+
+bool convert(std::string_view input, Sink& sink, const ConvertOptions& options, std::vector<Diagnostic>* diagnostics) {
+    Converter converter;
+    bool ok = converter.convert(input, sink, options);
+    if (diagnostics) {
+        *diagnostics = converter.diagnostics();
+    }
+    return ok;
+}
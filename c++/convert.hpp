@@ -0,0 +1,44 @@
+#pragma once
+#include <string_view>
+#include <vector>
+#include "parser.hpp"
+#include "sink.hpp"
+
+// The conversion on its own, for programs that embed it. To build it as a
+// library: g++ -std=c++17 -O2 -c convert.cpp parser.cpp node.cpp scan.cpp sink.cpp trace.cpp && ar rcs libconverter.a *.o
+
+struct ConvertOptions {
+    Limits limits;
+};
+
+// Converts Markdown to HTML. Token, node and output buffers are kept from
+// one call to the next, so a long-lived Converter settles into not
+// allocating. Use one per thread.
+class Converter {
+public:
+    Converter() : out(idle) {}
+    Converter(const Converter&) = delete;
+    Converter& operator=(const Converter&) = delete;
+
+    // Writes `input` to `sink` as HTML. Returns false if the input has
+    // errors, which are then in diagnostics() and nothing is written, or if
+    // the sink failed.
+    bool convert(std::string_view input, Sink& sink, const ConvertOptions& options = ConvertOptions());
+    const std::vector<Diagnostic>& diagnostics() const { return document.diagnostics(); }
+    // What the last convert() parsed, errors or not. It points into that
+    // input, so is only good while the input is. render() it with the
+    // writers in node.hpp for formats other than HTML.
+    const Document& parsed() const { return document; }
+    // Bytes written by the last convert()
+    size_t written() const { return bytes; }
+
+private:
+    Document document;
+    NullSink idle;
+    OutputBuffer out;
+    size_t bytes = 0;
+};
+
+// One conversion with a Converter of its own. If `diagnostics` is given,
+// any errors are copied there.
+bool convert(std::string_view input, Sink& sink, const ConvertOptions& options = ConvertOptions(), std::vector<Diagnostic>* diagnostics = nullptr);
@@ -1,4 +1,4 @@
-// To run: g++ converter.cpp parser.cpp node.cpp -o converter.exe && converter.exe ../input.md
+// To run: g++ -std=c++17 converter.cpp parser.cpp node.cpp file.cpp scan.cpp sink.cpp stream.cpp parallel.cpp pool.cpp batch.cpp incremental.cpp watch.cpp stats.cpp counters.cpp trace.cpp convert.cpp daemon.cpp cache.cpp -o converter.exe && converter.exe ../input.md
 // Pros:
 //  - Concept of streams built into language
 //  - Length is a member of strings/vectors
@@ -23,37 +23,444 @@
 //  - Exceptions can return from any function, no warning, no expectation to handle them, program doesn't crash, just silently exits. Awful!
 //  - Have to order declarations
 
-#include <iostream>
+#include <cstdlib>
 #include <fstream>
+#include <iostream>
 #include <string>
 #include <vector>
+#include "batch.hpp"
+#include "cache.hpp"
+#include "daemon.hpp"
+#include "file.hpp"
 #include "node.hpp"
+#include "parallel.hpp"
 #include "parser.hpp"
+#include "sink.hpp"
+#include "stats.hpp"
+#include "stream.hpp"
+#include "trace.hpp"
+#include "watch.hpp"
 
-auto main(int argc, char** argv)->int {
-    if (argc != 2) {
-        std::cerr << "usage: converter.exe <filename>" << std::endl;
+struct Options {
+    std::string input;
+    std::vector<std::string> inputs;
+    std::string fileList;
+    std::string output;
+    // -1 until set: one thread for a single file, one per core for a batch
+    int threads = -1;
+    bool watch = false;
+    bool stats = false;
+    // Where --stats goes; stderr if empty
+    std::string statsPath;
+    bool counters = false;
+    std::string tracePath;
+    Limits limits;
+    // Directory of cached trees; no caching if empty
+    std::string cachePath;
+    // Plain text and JSON renderings, written alongside the HTML if set
+    std::string textPath;
+    std::string jsonPath;
+    bool anchors = false;
+    // A table of contents, before the HTML if tocPath is empty
+    bool toc = false;
+    std::string tocPath;
+    bool daemon = false;
+    // Where --daemon listens; stdin if empty
+    std::string socketPath;
+};
+
+static void usage() {
+    std::cerr << "usage: converter.exe [-o <output>] [--threads <n>] [--watch] [--stats[=<path>] [--counters]] [--trace <path>] <filename>" << std::endl;
+    std::cerr << "       converter.exe [-o <dir>] [--threads <n>] [--stats[=<path>] [--counters]] [--trace <path>]" << std::endl;
+    std::cerr << "                     [--files-from <list>] <input>..." << std::endl;
+    std::cerr << "       converter.exe --daemon[=<socket>] [--threads <n>]" << std::endl;
+    std::cerr << "  Limits: [--max-input <bytes>] [--max-tokens <n>] [--max-nodes <n>] [--max-nesting <n>]" << std::endl;
+    std::cerr << "  Caching: [--cache <dir>]  Other formats: [--text <path>] [--json <path>]" << std::endl;
+    std::cerr << "  Anchors: [--anchors] [--toc[=<path>]]" << std::endl;
+    std::cerr << "  A filename of - streams stdin to stdout block by block." << std::endl;
+    std::cerr << "  Output goes to output.html unless -o is given (- for stdout)." << std::endl;
+    std::cerr << "  --threads splits a file across n threads (0 for one per core)." << std::endl;
+    std::cerr << "  --watch converts the file again every time it is saved." << std::endl;
+    std::cerr << "  --stats[=<path>] reports phase times and counters as JSON (to stderr by default)." << std::endl;
+    std::cerr << "  --counters adds hardware events per phase to --stats (Linux perf_event_open)." << std::endl;
+    std::cerr << "  --trace writes a Chrome trace-event timeline (chrome://tracing, Perfetto)." << std::endl;
+    std::cerr << "  Limits cap each document; input over one is an error, and emphasis nested" << std::endl;
+    std::cerr << "  deeper than --max-nesting is left as text. They don't apply to --watch." << std::endl;
+    std::cerr << "  Several inputs, a directory, a glob or a list (- for stdin) are converted" << std::endl;
+    std::cerr << "  as a batch, each to its own path with an .html extension, under -o if given." << std::endl;
+    std::cerr << "  --cache keeps parsed trees in <dir>, keyed by input bytes, so unchanged files" << std::endl;
+    std::cerr << "  aren't parsed again; a batch also converts identical files only once." << std::endl;
+    std::cerr << "  --text and --json also write a file's plain text and syntax tree, rendered" << std::endl;
+    std::cerr << "  in the same pass as the HTML." << std::endl;
+    std::cerr << "  --anchors gives each header an id made from its text, unique in the file." << std::endl;
+    std::cerr << "  --toc adds anchors and a table of contents linking to them, ahead of the" << std::endl;
+    std::cerr << "  HTML or on its own in <path>." << std::endl;
+    std::cerr << "  --daemon converts length-prefixed documents from stdin, or from connections" << std::endl;
+    std::cerr << "  to a Unix socket, until stopped; see daemon.hpp for the protocol." << std::endl;
+}
+
+static bool openOutput(FdSink& sink, const std::string& path) {
+    if (path == "-") {
+        sink.attach(1);
+        return true;
+    }
+    return sink.open(path);
+}
+
+static bool reportStats(const Options& options, const std::vector<std::string>& inputs, const std::vector<Stats>& stats) {
+    std::ofstream file;
+    if (!options.statsPath.empty()) {
+        file.open(options.statsPath);
+    }
+    std::ostream& out = options.statsPath.empty() ? std::cerr : file;
+    if (inputs.size() == 1) {
+        writeStatsJSON(out, inputs[0], stats[0]);
+    } else {
+        out << "{\"documents\": [\n";
+        for (size_t i = 0; i < inputs.size(); i++) {
+            writeStatsJSON(out, inputs[i], stats[i]);
+            out << (i + 1 < inputs.size() ? ",\n" : "\n");
+        }
+        out << "]}";
+    }
+    out << std::endl;
+    if (!out) {
+        std::cerr << "error writing " << options.statsPath << std::endl;
+        return false;
+    }
+    // The JSON says so too, but it may be going somewhere nobody's looking yet
+    if (!options.statsPath.empty() && !stats.empty() && !stats[0].hardwareError.empty()) {
+        std::cerr << "hardware counters unavailable: " << stats[0].hardwareError << std::endl;
+    }
+    return true;
+}
+
+static int convertFile(const Options& options, Stats& stats) {
+    // Map the file in; tokens and nodes point into it, so it has to stay
+    // open until output is written
+    stats.enter(Phase::Read);
+    MappedFile input;
+    if (!input.open(options.input)) {
+        std::cerr << "error reading input file " << options.input << std::endl;
+        return 1;
+    }
+
+    // A cached tree for the same bytes saves lexing and parsing altogether
+    TreeCache cache(options.cachePath);
+    CacheKey key = {};
+    CachedTree cached;
+    bool hit = false;
+    if (!options.cachePath.empty()) {
+        key = cacheKey(input.data(), options.limits, options.anchors);
+        hit = cache.load(key, input.data(), cached);
+    }
+
+    Document document;
+    Tree tree = cached.tree();
+    size_t tokens = 0;
+    if (!hit) {
+        stats.enter(Phase::Tokenize);
+        document.setLimits(options.limits);
+        document.setAnchors(options.anchors);
+        Parser parser = Parser(input.data(), document);
+        stats.enter(Phase::Parse);
+        tree = parser.parseDocument().tree();
+        tokens = parser.tokensUsed();
+        if (!document.diagnostics().empty()) {
+            printDiagnostic(std::cerr, document.diagnostics().front());
+            return 1;
+        }
+        if (!options.cachePath.empty() && !cache.store(key, tree)) {
+            std::cerr << "error writing to cache " << options.cachePath << std::endl;
+        }
+    }
+
+    stats.enter(Phase::Write);
+    FdSink file;
+    if (!openOutput(file, options.output)) {
+        std::cerr << "error writing output file" << std::endl;
+        return 1;
+    }
+    TimedSink timed(file, stats);
+    OutputBuffer out(timed);
+    FdSink textFile;
+    FdSink jsonFile;
+    TimedSink timedText(textFile, stats);
+    TimedSink timedJSON(jsonFile, stats);
+    OutputBuffer text(timedText);
+    OutputBuffer json(timedJSON);
+    bool texting = !options.textPath.empty();
+    bool jsoning = !options.jsonPath.empty();
+    if ((texting && !openOutput(textFile, options.textPath)) || (jsoning && !openOutput(jsonFile, options.jsonPath))) {
+        std::cerr << "error writing output file" << std::endl;
         return 1;
+    }
+    stats.enter(Phase::Render);
+    if (options.toc) {
+        if (options.tocPath.empty()) {
+            writeTOC(out, tree);
+        } else {
+            FdSink tocFile;
+            OutputBuffer toc(tocFile);
+            bool ok = openOutput(tocFile, options.tocPath);
+            if (ok) {
+                writeTOC(toc, tree);
+                ok = toc.flush();
+            }
+            if (!ok) {
+                std::cerr << "error writing " << options.tocPath << std::endl;
+                return 1;
+            }
+        }
+    }
+    HTMLWriter html{out, tree};
+    TextWriter plain{text, tree};
+    JSONWriter ast{json, tree};
+    if (texting && jsoning) {
+        render(tree, html, plain, ast);
+    } else if (texting) {
+        render(tree, html, plain);
+    } else if (jsoning) {
+        render(tree, html, ast);
     } else {
-        // Read contents into a big ole string
-        std::ifstream ifs(argv[1]);
-        std::string content;
-        content.assign( (std::istreambuf_iterator<char>(ifs) ),
-                        (std::istreambuf_iterator<char>()    ) );
-
-        Parser parser = Parser(content);
-        std::vector<Node*> nodes = parser.parseDocument();
-
-        std::fstream out;
-        out.open("output.html", std::ios::out);
-        if (!out) {
+        render(tree, html);
+    }
+    if (!out.flush() || !text.flush() || !json.flush()) {
+        std::cerr << "error writing output file" << std::endl;
+        return 1;
+    }
+
+    if (options.stats) {
+        stats.inputBytes = input.data().length();
+        stats.tokens = tokens;
+        stats.count(tree);
+        stats.outputBytes = out.written();
+    }
+    return 0;
+}
+
+static int convertFileParallel(const Options& options) {
+    MappedFile input;
+    if (!input.open(options.input)) {
+        std::cerr << "error reading input file " << options.input << std::endl;
+        return 1;
+    }
+
+    ThreadPool pool(options.threads);
+    ParallelConverter converter;
+    if (!converter.convert(input.data(), pool, options.limits)) {
+        printDiagnostic(std::cerr, converter.error());
+        return 1;
+    }
+
+    FdSink file;
+    if (!openOutput(file, options.output)) {
+        std::cerr << "error writing output file" << std::endl;
+        return 1;
+    }
+    OutputBuffer out(file);
+    converter.write(out);
+    if (!out.flush()) {
+        std::cerr << "error writing output file" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+static int convertMany(const Options& options) {
+    std::vector<BatchJob> jobs;
+    if (!collectJobs(options.inputs, options.fileList, options.output, jobs)) {
+        return 1;
+    }
+    std::vector<Stats> stats;
+    if (options.stats) {
+        stats.resize(jobs.size());
+        for (Stats& job : stats) {
+            job.hardware = options.counters;
+        }
+    }
+    BatchOptions batch;
+    batch.threads = options.threads < 0 ? 0 : options.threads;
+    batch.limits = options.limits;
+    batch.cacheDirectory = options.cachePath;
+    batch.anchors = options.anchors;
+    batch.toc = options.toc;
+    size_t failures = convertBatch(jobs, batch, options.stats ? &stats : nullptr);
+    if (options.stats) {
+        std::vector<std::string> inputs;
+        for (const BatchJob& job : jobs) {
+            inputs.push_back(job.input);
+        }
+        if (!reportStats(options, inputs, stats)) {
+            return 1;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+static int convertStdin(const Options& options, Stats& stats) {
+    FdSink file;
+    if (!openOutput(file, options.output)) {
+        std::cerr << "error writing output file" << std::endl;
+        return 1;
+    }
+    TimedSink timed(file, stats);
+    OutputBuffer out(timed);
+    // Tracing needs the phases even without --stats
+    if (!convertStream(0, out, options.stats || Trace::enabled() ? &stats : nullptr, options.limits)) {
+        if (out.failed()) {
             std::cerr << "error writing output file" << std::endl;
-        } else {
-            for (Node* node : nodes) {
-                out << node->getString() << std::endl;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+static bool parseCount(const char* text, size_t& count) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    count = size_t(value);
+    return *end == '\0' && end != text && text[0] != '-';
+}
+
+// Writes the trace, if one was asked for, once the conversion is done
+static int finish(const Options& options, int result) {
+    if (!options.tracePath.empty() && !Trace::write(options.tracePath)) {
+        std::cerr << "error writing " << options.tracePath << std::endl;
+        return 1;
+    }
+    return result;
+}
+
+auto main(int argc, char** argv)->int {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            options.output = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            char* end;
+            long threads = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || threads < 0) {
+                usage();
+                return 1;
+            }
+            options.threads = int(threads);
+        } else if (arg == "--watch") {
+            options.watch = true;
+        } else if (arg == "--stats" || arg.compare(0, 8, "--stats=") == 0) {
+            options.stats = true;
+            options.statsPath = arg.length() > 8 ? arg.substr(8) : "";
+        } else if (arg == "--counters") {
+            options.stats = true;
+            options.counters = true;
+        } else if ((arg == "--max-input" || arg == "--max-tokens" || arg == "--max-nodes" || arg == "--max-nesting") && i + 1 < argc) {
+            Limits& limits = options.limits;
+            size_t& limit = arg == "--max-input" ? limits.inputBytes : arg == "--max-tokens" ? limits.tokens : arg == "--max-nodes" ? limits.nodes : limits.nesting;
+            if (!parseCount(argv[++i], limit)) {
+                usage();
+                return 1;
             }
+        } else if (arg == "--trace" && i + 1 < argc) {
+            options.tracePath = argv[++i];
+        } else if (arg == "--text" && i + 1 < argc) {
+            options.textPath = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            options.jsonPath = argv[++i];
+        } else if (arg == "--anchors") {
+            options.anchors = true;
+        } else if (arg == "--toc" || arg.compare(0, 6, "--toc=") == 0) {
+            options.anchors = true;
+            options.toc = true;
+            options.tocPath = arg.length() > 6 ? arg.substr(6) : "";
+        } else if (arg == "--cache" && i + 1 < argc) {
+            options.cachePath = argv[++i];
+        } else if (arg == "--files-from" && i + 1 < argc) {
+            options.fileList = argv[++i];
+        } else if (arg == "--daemon" || arg.compare(0, 9, "--daemon=") == 0) {
+            options.daemon = true;
+            options.socketPath = arg.length() > 9 ? arg.substr(9) : "";
+        } else if (arg.length() > 1 && arg[0] == '-') {
+            usage();
+            return 1;
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+    if (options.daemon) {
+        if (!options.inputs.empty() || !options.fileList.empty() || !options.output.empty() || options.watch || options.stats || !options.tracePath.empty()
+                || !options.cachePath.empty() || !options.textPath.empty() || !options.jsonPath.empty() || options.anchors) {
+            usage();
+            return 1;
+        }
+        return runDaemon(options.socketPath, options.threads < 0 ? 0 : options.threads, options.limits);
+    }
+    if (options.inputs.empty() && options.fileList.empty()) {
+        usage();
+        return 1;
+    }
+
+    if (options.watch && !options.tracePath.empty()) {
+        usage();
+        return 1;
+    }
+    if (!options.tracePath.empty()) {
+        Trace::start();
+        Trace::nameThread("main");
+    }
+
+    if (options.inputs.size() != 1 || !options.fileList.empty() || isBatchInput(options.inputs[0])) {
+        if (options.watch || !options.textPath.empty() || !options.jsonPath.empty() || !options.tocPath.empty()) {
+            usage();
+            return 1;
+        }
+        return finish(options, convertMany(options));
+    }
+    options.input = options.inputs[0];
+    if (options.watch) {
+        if (options.input == "-" || options.stats || !options.cachePath.empty() || !options.textPath.empty() || !options.jsonPath.empty() || options.anchors) {
+            usage();
+            return 1;
         }
+        return watchFile(options.input, options.output.empty() ? "output.html" : options.output);
+    }
+    bool parallel = options.threads != -1 && options.threads != 1;
+    if (parallel && options.stats) {
+        // Phases overlap across threads, so there's no one time to give each
+        std::cerr << "--stats times a single-threaded conversion; leave out --threads" << std::endl;
+        return 1;
+    }
+    if (parallel && options.limits.wholeDocument()) {
+        // Each thread only sees its own piece
+        std::cerr << "--max-input, --max-tokens and --max-nodes need a single-threaded conversion; leave out --threads" << std::endl;
+        return 1;
+    }
+
+    if ((parallel || options.input == "-") && (!options.cachePath.empty() || !options.textPath.empty() || !options.jsonPath.empty() || options.anchors)) {
+        std::cerr << "--cache, --text, --json, --anchors and --toc need the whole file parsed at once; leave out --threads and -" << std::endl;
+        return 1;
+    }
 
-        return 0;
+    Stats stats;
+    stats.hardware = options.counters;
+    int result;
+    {
+        TraceSpan span("document", options.input);
+        if (options.input == "-") {
+            if (options.output.empty()) {
+                options.output = "-";
+            }
+            result = convertStdin(options, stats);
+        } else {
+            if (options.output.empty()) {
+                options.output = "output.html";
+            }
+            result = parallel ? convertFileParallel(options) : convertFile(options, stats);
+        }
+        stats.stop();
+    }
+    if (options.stats && !reportStats(options, {options.input}, {stats})) {
+        return 1;
     }
-}
\ No newline at end of file
+    return finish(options, result);
+}
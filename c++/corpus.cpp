@@ -0,0 +1,216 @@
+#include "corpus.hpp"
+
+namespace {
+
+// xorshift64*: tiny, and unlike <random>'s distributions it gives the same
+// sequence with every standard library
+struct Random {
+    uint64_t state;
+
+    Random(uint64_t seed) : state(seed * 2685821657736338717ull + 1) {}
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ull;
+    }
+    size_t below(size_t n) { return size_t(next() % n); }
+};
+
+const char* words[] = {
+    "the", "of", "and", "a", "to", "in", "is", "you", "that", "it", "he", "was", "for", "on", "are", "as",
+    "with", "his", "they", "at", "be", "this", "have", "from", "or", "one", "had", "by", "word", "but",
+    "not", "what", "all", "were", "we", "when", "your", "can", "said", "there", "use", "an", "each",
+    "which", "she", "do", "how", "their", "if", "will", "up", "other", "about", "out", "many", "then",
+    "them", "these", "so", "some", "her", "would", "make", "like", "him", "into", "time", "has", "look",
+    "two", "more", "write", "go", "see", "number", "no", "way", "could", "people", "my", "than", "first",
+    "water", "been", "call", "who", "oil", "its", "now", "find", "long", "down", "day", "did", "get",
+    "come", "made", "may", "part", "converter", "markdown", "parser", "token", "stream", "buffer",
+};
+const size_t wordCount = sizeof(words) / sizeof(words[0]);
+
+void word(Random& random, std::string& out) {
+    out += words[random.below(wordCount)];
+}
+
+void phrase(Random& random, std::string& out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            out += ' ';
+        }
+        word(random, out);
+    }
+}
+
+// Long paragraphs of plain words with the odd bit of emphasis: the lexer's
+// fast path
+void prose(Random& random, std::string& out) {
+    size_t sentences = 4 + random.below(12);
+    for (size_t i = 0; i < sentences; i++) {
+        phrase(random, out, 6 + random.below(14));
+        switch (random.below(8)) {
+        case 0:
+            out += " *";
+            word(random, out);
+            out += "*";
+            break;
+        case 1:
+            out += " **";
+            phrase(random, out, 2);
+            out += "**";
+            break;
+        case 2:
+            out += " `";
+            word(random, out);
+            out += "`";
+            break;
+        }
+        out += ". ";
+    }
+    out += "\n\n";
+}
+
+// Emphasis packed as densely and as deeply as the grammar allows: the
+// inline parser and the render walk
+void nesting(Random& random, std::string& out) {
+    size_t runs = 8 + random.below(24);
+    for (size_t i = 0; i < runs; i++) {
+        if (random.below(2)) {
+            out += "*";
+            word(random, out);
+            out += " **";
+            word(random, out);
+            out += "** ";
+            word(random, out);
+            out += "* ";
+        } else {
+            out += "__";
+            word(random, out);
+            out += " _";
+            word(random, out);
+            out += "_ ";
+            word(random, out);
+            out += "__ ";
+        }
+    }
+    out += "\n\n";
+}
+
+// Big fenced blocks, which are a single takeUntil each
+void code(Random& random, std::string& out) {
+    out += "```\n";
+    size_t lines = 200 + random.below(1800);
+    for (size_t i = 0; i < lines; i++) {
+        out.append(random.below(4) * 4, ' ');
+        switch (random.below(4)) {
+        case 0:
+            out += "const ";
+            word(random, out);
+            out += " = ";
+            word(random, out);
+            out += "(x * 2, [1, 2]);";
+            break;
+        case 1:
+            out += "if (";
+            word(random, out);
+            out += " != nil) { return #";
+            word(random, out);
+            out += "; }";
+            break;
+        case 2:
+            out += "// ";
+            phrase(random, out, 5);
+            break;
+        default:
+            out += "}";
+            break;
+        }
+        out += '\n';
+    }
+    out += "```\n";
+}
+
+// Paragraphs that are mostly links, and lines of images
+void links(Random& random, std::string& out) {
+    if (random.below(4) == 0) {
+        out += "![";
+        phrase(random, out, 3);
+        out += "](https://example.com/images/";
+        word(random, out);
+        out += ".png)\n";
+        return;
+    }
+    size_t count = 4 + random.below(12);
+    for (size_t i = 0; i < count; i++) {
+        out += "[";
+        phrase(random, out, 1 + random.below(3));
+        out += "](https://example.com/";
+        word(random, out);
+        out += "/";
+        word(random, out);
+        out += ") ";
+        word(random, out);
+        out += ' ';
+    }
+    out += "\n\n";
+}
+
+// Short headers and one-line paragraphs: per-block overhead
+void headers(Random& random, std::string& out) {
+    out.append(1 + random.below(6), '#');
+    out += ' ';
+    phrase(random, out, 1 + random.below(4));
+    out += '\n';
+    if (random.below(2)) {
+        phrase(random, out, 3 + random.below(8));
+        out += '\n';
+    }
+}
+
+typedef void (*Generator)(Random&, std::string&);
+
+struct Kind {
+    const char* name;
+    Generator block;
+};
+
+const Kind kinds[] = {
+    {"prose", prose},
+    {"nesting", nesting},
+    {"code", code},
+    {"links", links},
+    {"headers", headers},
+};
+
+}
+
+const std::vector<std::string>& corpusKinds() {
+    static const std::vector<std::string> names = [] {
+        std::vector<std::string> names;
+        for (const Kind& kind : kinds) {
+            names.push_back(kind.name);
+        }
+        return names;
+    }();
+    return names;
+}
+
+bool generateCorpus(const std::string& kind, size_t size, uint64_t seed, std::string& out) {
+    Generator block = nullptr;
+    for (const Kind& candidate : kinds) {
+        if (kind == candidate.name) {
+            block = candidate.block;
+        }
+    }
+    if (!block) {
+        return false;
+    }
+    Random random(seed);
+    out.clear();
+    out.reserve(size + 64 * 1024);
+    while (out.size() < size) {
+        block(random, out);
+    }
+    return true;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Synthetic Markdown for benchmarks, each kind stressing one part of the
+// converter. The same kind, size and seed always give the same bytes, on
+// any platform.
+const std::vector<std::string>& corpusKinds();
+
+// Generates about `size` bytes (always whole blocks) of the given kind.
+// Returns false if `kind` isn't one of corpusKinds().
+bool generateCorpus(const std::string& kind, size_t size, uint64_t seed, std::string& out);
@@ -0,0 +1,144 @@
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include "counters.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char* counterName(Counter counter) {
+    switch (counter) {
+    case Counter::Cycles: return "cycles";
+    case Counter::Instructions: return "instructions";
+    case Counter::L1Misses: return "l1d_misses";
+    case Counter::LLCMisses: return "llc_misses";
+    case Counter::BranchMisses: return "branch_misses";
+    }
+    return "?";
+}
+
+HardwareCounters& HardwareCounters::thread() {
+    static thread_local HardwareCounters counters;
+    return counters;
+}
+
+#ifdef __linux__
+
+static void describe(Counter counter, perf_event_attr& attr) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    switch (counter) {
+    case Counter::Cycles:
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case Counter::Instructions:
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case Counter::L1Misses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case Counter::LLCMisses:
+        // The generic cache-miss event, which is the last level on the CPUs that have one
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case Counter::BranchMisses:
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    }
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+}
+
+static std::string explain(int error) {
+    if (error == EACCES || error == EPERM) {
+        std::string level;
+        std::ifstream paranoid("/proc/sys/kernel/perf_event_paranoid");
+        paranoid >> level;
+        return "not permitted" + (level.empty() ? std::string() : " (perf_event_paranoid is " + level + ")");
+    }
+    if (error == ENOENT || error == EOPNOTSUPP || error == ENODEV) {
+        return "no hardware counters on this CPU";
+    }
+    if (error == ENOSYS) {
+        return "perf_event_open isn't supported by this kernel";
+    }
+    return strerror(error);
+}
+
+HardwareCounters::HardwareCounters() {
+    int firstError = 0;
+    for (size_t i = 0; i < counterCount; i++) {
+        fds[i] = -1;
+        slots[i] = -1;
+        perf_event_attr attr;
+        describe(Counter(i), attr);
+        attr.disabled = leader < 0;
+        int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+        if (fd < 0) {
+            firstError = firstError != 0 ? firstError : errno;
+            continue;
+        }
+        if (leader < 0) {
+            leader = fd;
+        }
+        fds[i] = fd;
+        slots[i] = int(opened++);
+    }
+    if (leader < 0) {
+        reason = explain(firstError);
+        return;
+    }
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+HardwareCounters::~HardwareCounters() {
+    for (int fd : fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool HardwareCounters::read(uint64_t totals[counterCount]) {
+    // nr, time enabled, time running, then one value per event
+    uint64_t group[3 + counterCount];
+    if (leader < 0 || ::read(leader, group, sizeof(group)) < ssize_t(3 * sizeof(uint64_t))) {
+        return false;
+    }
+    uint64_t enabled = group[1];
+    uint64_t running = group[2];
+    for (size_t i = 0; i < counterCount; i++) {
+        uint64_t value = slots[i] >= 0 && uint64_t(slots[i]) < group[0] ? group[3 + slots[i]] : 0;
+        if (running > 0 && running < enabled) {
+            value = uint64_t(double(value) * enabled / running);
+        }
+        totals[i] = value;
+    }
+    return true;
+}
+
+#else
+
+HardwareCounters::HardwareCounters() {
+    for (size_t i = 0; i < counterCount; i++) {
+        fds[i] = -1;
+        slots[i] = -1;
+    }
+    reason = "hardware counters need perf_event_open, which this platform doesn't have";
+}
+
+HardwareCounters::~HardwareCounters() {}
+
+bool HardwareCounters::read(uint64_t[counterCount]) {
+    return false;
+}
+
+#endif
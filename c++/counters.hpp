@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+enum class Counter {
+    Cycles,
+    Instructions,
+    L1Misses,
+    LLCMisses,
+    BranchMisses,
+};
+
+constexpr size_t counterCount = size_t(Counter::BranchMisses) + 1;
+const char* counterName(Counter counter);
+
+// Hardware event counters for the calling thread, opened with
+// perf_event_open as one group so that they all count over the same
+// stretch. Only user-space events are counted, which is all an unprivileged
+// process gets under the default perf_event_paranoid. Events the CPU or
+// kernel won't count are left out; if none can be opened, error() says why.
+class HardwareCounters {
+public:
+    // The calling thread's counters, opened on first use
+    static HardwareCounters& thread();
+
+    HardwareCounters(const HardwareCounters&) = delete;
+    HardwareCounters& operator=(const HardwareCounters&) = delete;
+    ~HardwareCounters();
+
+    bool available() const { return leader >= 0; }
+    bool counts(Counter counter) const { return slots[size_t(counter)] >= 0; }
+    const std::string& error() const { return reason; }
+
+    // Reads every event's total so far, scaled up if the kernel had to
+    // multiplex the group; events that aren't counted read as 0
+    bool read(uint64_t totals[counterCount]);
+
+private:
+    HardwareCounters();
+
+    int leader = -1;
+    int fds[counterCount];
+    // Where each counter comes in the group's read format, or -1
+    int slots[counterCount];
+    size_t opened = 0;
+    std::string reason;
+};
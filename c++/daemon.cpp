@@ -0,0 +1,435 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "convert.hpp"
+#include "daemon.hpp"
+#include "pool.hpp"
+#include "sink.hpp"
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Largest request taken when there's no input limit
+const size_t maxRequest = 256 * 1024 * 1024;
+// Seconds between reports while requests are coming in
+const int reportInterval = 10;
+// How many of the latest requests the percentiles are taken over
+const size_t latencyWindow = 64 * 1024;
+// Seconds a stop waits on clients to take their last responses
+const int stopGrace = 5;
+// Requests a connection can have read but not yet answered. Past this its
+// socket isn't read, so a client that sends faster than it takes responses
+// is held back by flow control instead of growing the queue.
+const size_t maxPending = 16;
+
+// Lock-free, so safe to set from the handler and read from any thread
+std::atomic<bool> stopping(false);
+
+void stop(int) {
+    stopping = true;
+}
+
+// False at the end of input, on an error, or if a stop signal interrupted it
+bool readAll(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = read(fd, data, length);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool skip(int fd, size_t length) {
+    char discard[4096];
+    while (length > 0) {
+        size_t n = std::min(length, sizeof(discard));
+        if (!readAll(fd, discard, n)) {
+            return false;
+        }
+        length -= n;
+    }
+    return true;
+}
+
+// Latencies of the latest requests, in microseconds
+class Latencies {
+public:
+    void record(double latency) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (samples.size() < latencyWindow) {
+            samples.push_back(latency);
+        } else {
+            samples[next] = latency;
+        }
+        next = (next + 1) % latencyWindow;
+    }
+
+    // Nearest-rank percentiles, or 0 for each if nothing's been recorded
+    std::vector<double> percentiles(const std::vector<double>& ranks) {
+        std::vector<double> sorted;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            sorted = samples;
+        }
+        std::sort(sorted.begin(), sorted.end());
+        std::vector<double> result;
+        for (double p : ranks) {
+            size_t rank = size_t(std::ceil(p / 100 * sorted.size()));
+            result.push_back(sorted.empty() ? 0 : sorted[rank > 0 ? rank - 1 : 0]);
+        }
+        return result;
+    }
+
+private:
+    std::mutex lock;
+    std::vector<double> samples;
+    size_t next = 0;
+};
+
+struct Response {
+    bool done = false;
+    bool ok = false;
+    std::string body;
+    Clock::time_point received;
+};
+
+// One client. Responses wait in `pending` until those before them are
+// done, so they go out in request order whichever worker finishes first.
+// Workers only fill them in; the connection's own writer thread sends them,
+// so a client that doesn't read holds up nobody else.
+struct Connection {
+    FdSink out;
+    std::mutex lock;
+    // Signalled when the front response is done, and when reading stops
+    std::condition_variable ready;
+    // Signalled when a response leaves `pending`
+    std::condition_variable room;
+    std::deque<Response> pending;
+    // How many responses have left `pending`
+    uint64_t written = 0;
+    // Cleared once no more requests will be read
+    bool reading = true;
+
+    Connection(int fd) : out(fd) {}
+};
+
+class Daemon {
+public:
+    Daemon(unsigned threads, const Limits& limits) : pool(threads) {
+        for (unsigned i = 0; i < pool.size(); i++) {
+            converters.emplace_back(new Converter());
+        }
+        options.limits = limits;
+        reporter = std::thread([this] { reportWhileBusy(); });
+    }
+
+    ~Daemon() {
+        {
+            std::lock_guard<std::mutex> guard(reportLock);
+            finished = true;
+        }
+        reportWake.notify_all();
+        reporter.join();
+        report();
+    }
+
+    // Answers requests from `in` on `out` until `in` ends
+    void serve(int in, int out) {
+        Connection connection(out);
+        std::thread writer([this, &connection] { writeResponses(connection); });
+        size_t limit = options.limits.inputBytes ? options.limits.inputBytes : maxRequest;
+        // A stop that came while waiting for room has no read to interrupt
+        while (!stopping) {
+            unsigned char header[4];
+            if (!readAll(in, reinterpret_cast<char*>(header), sizeof(header))) {
+                break;
+            }
+            size_t length = size_t(header[0]) << 24 | size_t(header[1]) << 16 | size_t(header[2]) << 8 | header[3];
+            std::string request;
+            if (length > limit) {
+                if (!skip(in, length)) {
+                    break;
+                }
+            } else {
+                request.resize(length);
+                if (!readAll(in, &request[0], length)) {
+                    break;
+                }
+            }
+
+            uint64_t sequence;
+            {
+                std::unique_lock<std::mutex> guard(connection.lock);
+                connection.room.wait(guard, [&connection] { return connection.pending.size() < maxPending; });
+                sequence = connection.written + connection.pending.size();
+                connection.pending.emplace_back();
+                connection.pending.back().received = Clock::now();
+            }
+            if (length > limit) {
+                respond(connection, sequence, false, "error: request is larger than " + std::to_string(limit) + " bytes\n");
+                continue;
+            }
+            size_t depth = ++queued;
+            size_t deepest = maxQueued;
+            while (depth > deepest && !maxQueued.compare_exchange_weak(deepest, depth)) {
+            }
+            pool.submit([this, &connection, sequence, request = std::move(request)](unsigned worker) {
+                queued--;
+                std::string body;
+                StringSink sink(body);
+                Converter& converter = *converters[worker];
+                bool ok = converter.convert(request, sink, options);
+                if (!ok) {
+                    std::ostringstream message;
+                    for (const Diagnostic& diagnostic : converter.diagnostics()) {
+                        printDiagnostic(message, diagnostic);
+                    }
+                    body = message.str();
+                }
+                respond(connection, sequence, ok, std::move(body));
+            });
+        }
+        {
+            std::lock_guard<std::mutex> guard(connection.lock);
+            connection.reading = false;
+            connection.ready.notify_all();
+        }
+        // The writer leaves once the pool has answered everything read
+        writer.join();
+    }
+
+private:
+    // Notifies under the lock, so the connection can't go away before the
+    // worker is done with it
+    void respond(Connection& connection, uint64_t sequence, bool ok, std::string body) {
+        std::lock_guard<std::mutex> guard(connection.lock);
+        Response& response = connection.pending[sequence - connection.written];
+        response.done = true;
+        response.ok = ok;
+        response.body = std::move(body);
+        if (&response == &connection.pending.front()) {
+            connection.ready.notify_all();
+        }
+    }
+
+    // Sends responses in order until reading has stopped and none are left.
+    // After a failed write the rest are dropped, but still counted.
+    void writeResponses(Connection& connection) {
+        bool broken = false;
+        std::unique_lock<std::mutex> guard(connection.lock);
+        for (;;) {
+            connection.ready.wait(guard, [&connection] {
+                return connection.pending.empty() ? !connection.reading : connection.pending.front().done;
+            });
+            if (connection.pending.empty()) {
+                return;
+            }
+            Response next = std::move(connection.pending.front());
+            connection.pending.pop_front();
+            connection.written++;
+            connection.room.notify_all();
+            guard.unlock();
+
+            if (!broken) {
+                size_t length = next.body.length();
+                char header[5] = {char(next.ok ? 0 : 1), char(length >> 24), char(length >> 16), char(length >> 8), char(length)};
+                broken = !connection.out.write(header, sizeof(header)) || !connection.out.write(next.body.data(), length);
+            }
+            latencies.record(std::chrono::duration<double, std::micro>(Clock::now() - next.received).count());
+            requests++;
+            if (!next.ok) {
+                failures++;
+            }
+            guard.lock();
+        }
+    }
+
+    void report() {
+        std::vector<double> p = latencies.percentiles({50, 99, 99.9});
+        std::lock_guard<std::mutex> guard(reportLock);
+        std::cerr << "{\"requests\": " << requests << ", \"errors\": " << failures
+                  << ", \"latency_us\": {\"p50\": " << std::fixed << std::setprecision(1) << p[0]
+                  << ", \"p99\": " << p[1] << ", \"p999\": " << p[2] << "}"
+                  << ", \"queue_depth\": " << queued << ", \"max_queue_depth\": " << maxQueued << "}" << std::endl;
+    }
+
+    void reportWhileBusy() {
+        size_t reported = 0;
+        std::unique_lock<std::mutex> guard(reportLock);
+        while (!reportWake.wait_for(guard, std::chrono::seconds(reportInterval), [this] { return finished; })) {
+            if (requests != reported) {
+                reported = requests;
+                guard.unlock();
+                report();
+                guard.lock();
+            }
+        }
+    }
+
+    ThreadPool pool;
+    std::vector<std::unique_ptr<Converter>> converters;
+    ConvertOptions options;
+    Latencies latencies;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> maxQueued{0};
+    std::atomic<size_t> requests{0};
+    std::atomic<size_t> failures{0};
+
+    std::mutex reportLock;
+    std::condition_variable reportWake;
+    bool finished = false;
+    std::thread reporter;
+};
+
+// Connections still being served, each on a thread of its own, so that a
+// stop can cut their input and wait for them to answer what they've read. A
+// client that isn't reading its responses gets a few seconds before its
+// output is cut too. Threads are joined, never detached, so none is left
+// touching this once closeAll() returns.
+class Connections {
+public:
+    void start(Daemon& daemon, int fd) {
+        std::lock_guard<std::mutex> guard(lock);
+        // Reaped before adding, as `fd` may be the number a finished
+        // connection had
+        for (int done : finished) {
+            threads[done].join();
+            threads.erase(done);
+        }
+        finished.clear();
+        open.insert(fd);
+        threads[fd] = std::thread([this, &daemon, fd] {
+            daemon.serve(fd, fd);
+            finish(fd);
+        });
+    }
+
+    void closeAll() {
+        std::map<int, std::thread> joining;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            for (int fd : open) {
+                shutdown(fd, SHUT_RD);
+            }
+            if (!closed.wait_for(guard, std::chrono::seconds(stopGrace), [this] { return open.empty(); })) {
+                for (int fd : open) {
+                    shutdown(fd, SHUT_RDWR);
+                }
+                closed.wait(guard, [this] { return open.empty(); });
+            }
+            joining.swap(threads);
+        }
+        for (auto& entry : joining) {
+            entry.second.join();
+        }
+    }
+
+private:
+    void finish(int fd) {
+        std::lock_guard<std::mutex> guard(lock);
+        open.erase(fd);
+        ::close(fd);
+        finished.push_back(fd);
+        closed.notify_all();
+    }
+
+    std::mutex lock;
+    std::condition_variable closed;
+    std::set<int> open;
+    std::map<int, std::thread> threads;
+    // Connections whose threads have finished but not been joined
+    std::vector<int> finished;
+};
+
+int serveSocket(Daemon& daemon, const std::string& path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.length() >= sizeof(address.sun_path)) {
+        std::cerr << "socket path is too long: " << path << std::endl;
+        return 1;
+    }
+    memcpy(address.sun_path, path.c_str(), path.length() + 1);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        std::cerr << "error listening on " << path << std::endl;
+        if (listener >= 0) {
+            close(listener);
+        }
+        return 1;
+    }
+
+    Connections connections;
+    while (!stopping) {
+        // Waking now and then to notice a stop
+        pollfd ready = {listener, POLLIN, 0};
+        if (poll(&ready, 1, 500) <= 0) {
+            continue;
+        }
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        connections.start(daemon, fd);
+    }
+    close(listener);
+    unlink(path.c_str());
+    connections.closeAll();
+    return 0;
+}
+
+}
+
+int runDaemon(const std::string& socketPath, unsigned threads, const Limits& limits) {
+    struct sigaction action = {};
+    action.sa_handler = stop;
+    // No SA_RESTART, so that a blocking read gives up on a stop
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    // A client that hangs up shows as a failed write instead
+    signal(SIGPIPE, SIG_IGN);
+
+    Daemon daemon(threads, limits);
+    if (socketPath.empty()) {
+        daemon.serve(0, 1);
+        return 0;
+    }
+    return serveSocket(daemon, socketPath);
+}
+
+#else
+
+int runDaemon(const std::string&, unsigned, const Limits&) {
+    std::cerr << "--daemon needs POSIX sockets and signals, which this platform doesn't have" << std::endl;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+#include "parser.hpp"
+
+// Serves conversions to a long-running client, so that it doesn't pay for
+// starting a process per document. Requests come in on a Unix domain socket
+// at `socketPath`, over any number of connections, or on stdin with
+// responses on stdout if the path is empty. On each connection:
+//   request:  4-byte big-endian length, then that many bytes of Markdown
+//   response: 1 status byte (0 for HTML, 1 for error messages), 4-byte
+//             big-endian length, then that many bytes
+// Responses come back in the order of the requests. A connection has at
+// most a few requests in flight; past that it isn't read until responses
+// have gone out. Requests are converted on a pool of `threads` workers (0
+// for one per core), each held to `limits`. Request count, latency
+// percentiles and queue depth go to stderr as JSON now and then while busy,
+// and on exit: at the end of stdin, or on SIGINT or SIGTERM, after answering
+// every request already read.
+int runDaemon(const std::string& socketPath, unsigned threads, const Limits& limits);
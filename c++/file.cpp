@@ -0,0 +1,58 @@
+#include <fstream>
+#include <iterator>
+#include "file.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_MMAP 1
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+#ifdef HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            madvise(addr, st.st_size, MADV_SEQUENTIAL);
+            ::close(fd);
+            begin = static_cast<const char*>(addr);
+            length = st.st_size;
+            mapped = true;
+            return true;
+        }
+    }
+    ::close(fd);
+#endif
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        return false;
+    }
+    buffer.assign((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    begin = buffer.data();
+    length = buffer.size();
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef HAVE_MMAP
+    if (mapped) {
+        munmap(const_cast<char*>(begin), length);
+    }
+#endif
+    begin = nullptr;
+    length = 0;
+    mapped = false;
+    buffer.clear();
+}
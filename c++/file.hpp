@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+// Read-only view of a whole input file. Regular files are memory-mapped so
+// the lexer can slice tokens straight out of the page cache; anything that
+// can't be mapped (pipes, empty files, non-POSIX hosts) is read into an owned
+// buffer instead.
+class MappedFile {
+public:
+    MappedFile() {}
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    std::string_view data() const { return std::string_view(begin, length); }
+
+private:
+    const char* begin = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::string buffer;
+};
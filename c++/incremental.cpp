@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <cstring>
+#include "incremental.hpp"
+#include "node.hpp"
+
+// How far past the edit the first attempt at re-parsing reaches; it doubles
+// each time that turns out not to be far enough to line up again
+static const size_t firstWindow = 4096;
+
+// FNV-1a over a block's source and the byte after it, which decides how the
+// block's last token lexes
+static uint64_t hashBlock(std::string_view text, size_t start, size_t end) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = start; i < end; i++) {
+        hash = (hash ^ uint8_t(text[i])) * 1099511628211ull;
+    }
+    int next = end < text.length() ? uint8_t(text[end]) : 256;
+    return (hash ^ next) * 1099511628211ull;
+}
+
+static bool sameBlock(std::string_view a, size_t aStart, size_t aEnd, std::string_view b, size_t bStart, size_t bEnd) {
+    if (aEnd - aStart != bEnd - bStart || (aEnd < a.length()) != (bEnd < b.length())) {
+        return false;
+    }
+    if (aEnd < a.length() && a[aEnd] != b[bEnd]) {
+        return false;
+    }
+    return a.compare(aStart, aEnd - aStart, b, bStart, bEnd - bStart) == 0;
+}
+
+void IncrementalConverter::render(const Tree& tree, uint32_t node, Block& block) {
+    writeHTML(scratchOut, tree, node);
+    scratchOut.append('\n');
+    scratchOut.flush();
+    block.html = scratch;
+    scratch.clear();
+    renderCount++;
+}
+
+void IncrementalConverter::join() {
+    output.clear();
+    for (const Block& block : blocks) {
+        output += block.html;
+    }
+}
+
+bool IncrementalConverter::rebuild(std::string newText) {
+    text = std::move(newText);
+    blocks.clear();
+    renderCount = 0;
+    valid = false;
+
+    Parser parser(text, document);
+    parser.parseDocument();
+    if (!document.diagnostics().empty()) {
+        firstError = document.diagnostics().front();
+        return false;
+    }
+    Tree tree = document.tree();
+    const std::vector<uint32_t>& offsets = document.blockOffsets();
+    blocks.resize(tree.blockCount);
+    for (size_t i = 0; i < tree.blockCount; i++) {
+        Block& block = blocks[i];
+        block.start = offsets[i];
+        block.end = i + 1 < tree.blockCount ? offsets[i + 1] : text.length();
+        block.hash = hashBlock(text, block.start, block.end);
+        render(tree, tree.blocks[i], block);
+    }
+    join();
+    valid = true;
+    return true;
+}
+
+bool IncrementalConverter::update(std::string newText) {
+    // An edited or moved definition changes links anywhere in the document
+    if (!valid || mayDefineReferences(text) || mayDefineReferences(newText)) {
+        return rebuild(std::move(newText));
+    }
+    renderCount = 0;
+
+    // The edit replaced old [prefix, oldLength - suffix) with new [prefix, editEnd)
+    size_t oldLength = text.length();
+    size_t length = newText.length();
+    size_t shorter = std::min(oldLength, length);
+    size_t prefix = std::mismatch(text.begin(), text.begin() + shorter, newText.begin()).first - text.begin();
+    if (prefix == oldLength && prefix == length) {
+        return true;
+    }
+    size_t suffix = 0;
+    while (suffix < shorter - prefix && text[oldLength - 1 - suffix] == newText[length - 1 - suffix]) {
+        suffix++;
+    }
+    size_t editEnd = length - suffix;
+    size_t oldEditEnd = oldLength - suffix;
+
+    // A block is untouched if it and the byte after it come before the edit
+    size_t kept = 0;
+    while (kept < blocks.size() && blocks[kept].end < prefix) {
+        kept++;
+    }
+    size_t pos = kept > 0 ? blocks[kept - 1].end : 0;
+
+    std::vector<Block> fresh;
+    size_t resume = blocks.size();
+    size_t window = firstWindow;
+    for (;;) {
+        size_t end = std::max(pos, editEnd) + window;
+        if (end >= length) {
+            end = length;
+        } else {
+            const char* newline = static_cast<const char*>(memchr(newText.data() + end, '\n', length - end));
+            end = newline ? newline - newText.data() + 1 : length;
+        }
+        bool final = end == length;
+
+        Parser parser(std::string_view(newText).substr(pos, end - pos), document);
+        parser.parseBlocks(final);
+        if (!document.diagnostics().empty()) {
+            // Errors are rare enough that a full parse, for an accurate
+            // position, is fine
+            return rebuild(std::move(newText));
+        }
+        Tree tree = document.tree();
+        const std::vector<uint32_t>& offsets = document.blockOffsets();
+
+        // Look for a block that starts where an old one did, past the edit;
+        // everything from there on parses as it did before
+        size_t count = tree.blockCount;
+        bool synced = false;
+        for (size_t i = 0; i < count; i++) {
+            size_t start = pos + offsets[i];
+            if (start < editEnd) {
+                continue;
+            }
+            size_t oldStart = start - editEnd + oldEditEnd;
+            auto old = std::lower_bound(blocks.begin() + kept, blocks.end(), oldStart, [](const Block& block, size_t offset) { return block.start < offset; });
+            if (old != blocks.end() && old->start == oldStart) {
+                resume = old - blocks.begin();
+                count = i;
+                synced = true;
+                break;
+            }
+        }
+        // Without a sync point, the last block's extent isn't known until
+        // the next block has been seen
+        if (!synced && !final && count > 0) {
+            count--;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            Block block;
+            block.start = pos + offsets[i];
+            block.end = i + 1 < tree.blockCount ? pos + offsets[i + 1] : length;
+            block.hash = hashBlock(newText, block.start, block.end);
+            // An edit rarely moves a block far from its old place in the
+            // list, so only the few old blocks around there are candidates
+            size_t near = kept + fresh.size();
+            bool cached = false;
+            for (size_t j = near > kept + 2 ? near - 2 : kept; j < std::min(near + 3, blocks.size()); j++) {
+                const Block& old = blocks[j];
+                if (old.hash == block.hash && sameBlock(text, old.start, old.end, newText, block.start, block.end)) {
+                    block.html = old.html;
+                    cached = true;
+                    break;
+                }
+            }
+            if (!cached) {
+                render(tree, tree.blocks[i], block);
+            }
+            fresh.push_back(std::move(block));
+        }
+        if (synced || final) {
+            break;
+        }
+        if (count > 0) {
+            pos = fresh.back().end;
+        }
+        window *= 2;
+    }
+
+    // Splice: untouched blocks before the edit, the re-parsed ones, and
+    // the old blocks after the sync point moved by the change in length
+    std::vector<Block> next;
+    next.reserve(kept + fresh.size() + blocks.size() - resume);
+    for (size_t i = 0; i < kept; i++) {
+        next.push_back(std::move(blocks[i]));
+    }
+    for (Block& block : fresh) {
+        next.push_back(std::move(block));
+    }
+    for (size_t i = resume; i < blocks.size(); i++) {
+        Block& block = blocks[i];
+        block.start = block.start - oldEditEnd + editEnd;
+        block.end = block.end - oldEditEnd + editEnd;
+        next.push_back(std::move(block));
+    }
+    blocks = std::move(next);
+    text = std::move(newText);
+    join();
+    return true;
+}
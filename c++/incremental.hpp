@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "parser.hpp"
+#include "sink.hpp"
+
+// Converts successive versions of one document, redoing only the part an
+// edit touched. Each top-level block is kept with its rendered HTML and a
+// hash of its source. On update, blocks wholly before the first changed byte
+// are kept as they are; parsing restarts where they end and runs until
+// it meets a block start that lines up with an old block past the last
+// changed byte, from where the old blocks are kept too. Re-parsed blocks
+// whose source hashes the same as a block they replace reuse its HTML.
+class IncrementalConverter {
+public:
+    // Converts `text`, reusing what it can from the last successful call.
+    // Returns false on a parse error, which is in error().
+    bool update(std::string text);
+
+    const std::string& html() const { return output; }
+    const Diagnostic& error() const { return firstError; }
+    // Blocks in the document, and how many the last update had to render
+    size_t blockCount() const { return blocks.size(); }
+    size_t rendered() const { return renderCount; }
+
+private:
+    struct Block {
+        // Source range, from the block's first token to the next block's
+        size_t start;
+        size_t end;
+        uint64_t hash;
+        std::string html;
+    };
+
+    bool rebuild(std::string text);
+    void render(const Tree& tree, uint32_t node, Block& block);
+    void join();
+
+    std::string text;
+    std::vector<Block> blocks;
+    bool valid = false;
+    Document document;
+    std::string scratch;
+    StringSink scratchSink{scratch};
+    OutputBuffer scratchOut{scratchSink};
+    std::string output;
+    Diagnostic firstError;
+    size_t renderCount = 0;
+};
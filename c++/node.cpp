@@ -1,71 +1,258 @@
-#include <string>
-#include <sstream>
+#include <algorithm>
 #include "node.hpp"
+#include "scan.hpp"
 
-std::string Header::getString() {
-    std::ostringstream ss;
-    ss << "<h" << size << ">";
-    for (Node* node : children) {
-        ss << node->getString();
+const char* nodeKindName(NodeKind kind) {
+    switch (kind) {
+    case NodeKind::Header: return "Header";
+    case NodeKind::Paragraph: return "Paragraph";
+    case NodeKind::CodeBlock: return "CodeBlock";
+    case NodeKind::Image: return "Image";
+    case NodeKind::Text: return "Text";
+    case NodeKind::Italic: return "Italic";
+    case NodeKind::Bold: return "Bold";
+    case NodeKind::Code: return "Code";
+    case NodeKind::Link: return "Link";
     }
-    ss << "</h" << size << ">";
-    return ss.str();
+    return "?";
 }
 
-std::string Paragraph::getString() {
-    std::ostringstream ss;
-    ss << "<p>";
-    for (Node* node : children) {
-        ss << node->getString();
+const Heading* Tree::heading(const Node& node) const {
+    uint32_t index = uint32_t(&node - nodes);
+    const Heading* end = headings + headingCount;
+    const Heading* found = std::lower_bound(headings, end, index, [](const Heading& heading, uint32_t node) { return heading.node < node; });
+    return found != end && found->node == index ? found : nullptr;
+}
+
+namespace {
+
+// Appends `text` with the characters HTML gives a meaning to replaced by
+// entities. Clean runs between them are found a vector at a time and copied
+// whole, so text with nothing to escape costs a scan and a memcpy.
+void appendEscaped(OutputBuffer& out, std::string_view text, bool attribute) {
+    const char* p = text.data();
+    const char* end = p + text.length();
+    while (p < end) {
+        const char* special = findEscape(p, end, attribute);
+        out.append(p, special - p);
+        if (special == end) {
+            break;
+        }
+        switch (*special) {
+        case '<': out.append("&lt;"); break;
+        case '>': out.append("&gt;"); break;
+        case '&': out.append("&amp;"); break;
+        case '"': out.append("&quot;"); break;
+        }
+        p = special + 1;
+    }
+}
+
+}
+
+void HTMLWriter::enter(const Node& node) {
+    switch (node.kind) {
+    case NodeKind::Header:
+        out.append("<h");
+        out.appendInt(node.level);
+        if (const Heading* heading = tree.heading(node)) {
+            out.append(" id=\"");
+            appendEscaped(out, tree.id(*heading), true);
+            out.append('"');
+        }
+        out.append(">");
+        break;
+    case NodeKind::Paragraph:
+        out.append("<p>");
+        break;
+    case NodeKind::CodeBlock:
+        out.append("<pre><code>");
+        appendEscaped(out, tree.text(node), false);
+        out.append("</code></pre>\n");
+        break;
+    case NodeKind::Image:
+        out.append("<img src=\"");
+        appendEscaped(out, tree.url(node), true);
+        out.append("\" alt=\"");
+        appendEscaped(out, tree.text(node), true);
+        out.append("\" />\n");
+        break;
+    case NodeKind::Text:
+        appendEscaped(out, tree.text(node), false);
+        break;
+    case NodeKind::Italic:
+        out.append("<em>");
+        break;
+    case NodeKind::Bold:
+        out.append("<strong>");
+        break;
+    case NodeKind::Code:
+        out.append("<code>");
+        appendEscaped(out, tree.text(node), false);
+        out.append("</code>");
+        break;
+    case NodeKind::Link:
+        out.append("<a href=\"");
+        appendEscaped(out, tree.url(node), true);
+        out.append("\">");
+        appendEscaped(out, tree.text(node), false);
+        out.append("</a>");
+        break;
+    }
+}
+
+void HTMLWriter::leave(const Node& node) {
+    switch (node.kind) {
+    case NodeKind::Header:
+        out.append("</h");
+        out.appendInt(node.level);
+        out.append(">");
+        break;
+    case NodeKind::Paragraph:
+        out.append("</p>\n");
+        break;
+    case NodeKind::Italic:
+        out.append("</em>");
+        break;
+    case NodeKind::Bold:
+        out.append("</strong>");
+        break;
+    default:
+        break;
+    }
+}
+
+void TextWriter::enter(const Node& node) {
+    switch (node.kind) {
+    case NodeKind::CodeBlock:
+    case NodeKind::Image:
+    case NodeKind::Text:
+    case NodeKind::Code:
+    case NodeKind::Link:
+        out.append(tree.text(node));
+        break;
+    default:
+        break;
     }
-    ss << "</p>\n";
-    return ss.str();
 }
 
-std::string CodeBlock::getString() {
-    std::ostringstream ss;
-    ss << "<pre><code>" << text << "</pre></code>\n";
-    return ss.str();
+void TextWriter::leave(const Node&) {}
+
+void JSONWriter::begin() {
+    out.append("{\"blocks\": [");
+    separate = false;
+}
+
+void JSONWriter::enter(const Node& node) {
+    if (separate) {
+        out.append(", ");
+    }
+    out.append("{\"kind\": \"");
+    out.append(nodeKindName(node.kind));
+    out.append('"');
+    switch (node.kind) {
+    case NodeKind::Header:
+        out.append(", \"level\": ");
+        out.appendInt(node.level);
+        if (const Heading* heading = tree.heading(node)) {
+            out.append(", \"id\": ");
+            appendJSONString(out, tree.id(*heading));
+        }
+        break;
+    case NodeKind::CodeBlock:
+    case NodeKind::Text:
+    case NodeKind::Code:
+        out.append(", \"text\": ");
+        appendJSONString(out, tree.text(node));
+        break;
+    case NodeKind::Image:
+    case NodeKind::Link:
+        out.append(", \"text\": ");
+        appendJSONString(out, tree.text(node));
+        out.append(", \"url\": ");
+        appendJSONString(out, tree.url(node));
+        break;
+    default:
+        break;
+    }
+    if (node.firstChild != NoNode) {
+        out.append(", \"children\": [");
+    }
+    separate = false;
 }
 
-std::string Image::getString() {
-    std::ostringstream ss;
-    ss << "<img src=\"" << url << "\" alt=\"" << text << "\" />\n";
-    return ss.str();
+void JSONWriter::leave(const Node& node) {
+    out.append(node.firstChild != NoNode ? "]}" : "}");
+    separate = true;
 }
 
-std::string Text::getString() {
-    return text;
+void JSONWriter::end() {
+    out.append("]}\n");
 }
 
-std::string Italic::getString() {
-    std::ostringstream ss;
-    ss << "<em>";
-    for (Node* node : children) {
-        ss << node->getString();
+namespace {
+
+// A header's content inside a TOC link, which can't hold another link
+struct TOCEntryWriter : HTMLWriter {
+    void enter(const Node& node) {
+        if (node.kind == NodeKind::Link) {
+            appendEscaped(out, tree.text(node), false);
+        } else {
+            HTMLWriter::enter(node);
+        }
     }
-    ss << "</em>";
-    return ss.str();
+};
+
 }
 
-std::string Bold::getString() {
-    std::ostringstream ss;
-    ss << "<strong>";
-    for (Node* node : children) {
-        ss << node->getString();
+// Each heading's list item is left open in case the next one nests under
+// it. `open` holds the level of each list that is open; a heading closes
+// the lists whose parent is at its level or deeper, so one that skips a
+// level (h1 then h3) still nests a single step.
+void writeTOC(OutputBuffer& out, const Tree& tree) {
+    if (tree.headingCount == 0) {
+        return;
+    }
+    TOCEntryWriter writer{{out, tree}};
+    std::vector<int> open;
+    out.append("<nav class=\"toc\">\n");
+    for (size_t i = 0; i < tree.headingCount; i++) {
+        const Heading& heading = tree.headings[i];
+        const Node& header = tree.nodes[heading.node];
+        int level = header.level;
+        if (open.empty() || level > open.back()) {
+            out.append("<ul>\n");
+            open.push_back(level);
+        } else {
+            out.append("</li>\n");
+            while (open.size() > 1 && open[open.size() - 2] >= level) {
+                open.pop_back();
+                out.append("</ul>\n</li>\n");
+            }
+            open.back() = level;
+        }
+        out.append("<li><a href=\"#");
+        appendEscaped(out, tree.id(heading), true);
+        out.append("\">");
+        for (uint32_t child = header.firstChild; child != NoNode; child = tree.nodes[child].nextSibling) {
+            walk(tree, child, writer);
+        }
+        out.append("</a>");
+    }
+    out.append("</li>\n");
+    while (open.size() > 1) {
+        open.pop_back();
+        out.append("</ul>\n</li>\n");
     }
-    ss << "</strong>";
-    return ss.str();
+    out.append("</ul>\n</nav>\n");
 }
 
-std::string Code::getString() {
-    std::ostringstream ss;
-    ss << "<code>" << text << "</code>";
-    return ss.str();
+void writeHTML(OutputBuffer& out, const Tree& tree, uint32_t block) {
+    HTMLWriter writer{out, tree};
+    walk(tree, block, writer);
 }
 
-std::string Link::getString() {
-    std::ostringstream ss;
-    ss << "<a href=\"" << url << "\">" << text << "</a>";
-    return ss.str();
+void writeHTML(OutputBuffer& out, const Tree& tree) {
+    HTMLWriter writer{out, tree};
+    render(tree, writer);
 }
@@ -1,131 +1,188 @@
 #pragma once
-#include <string>
+#include <cstdint>
+#include <string_view>
+#include <tuple>
 #include <vector>
-
-class Node {
-public:
-    virtual std::string getString() = 0;
+#include "sink.hpp"
+
+enum class NodeKind : uint8_t {
+    Header,
+    Paragraph,
+    CodeBlock,
+    Image,
+    Text,
+    Italic,
+    Bold,
+    Code,
+    Link,
 };
 
+constexpr size_t nodeKindCount = size_t(NodeKind::Link) + 1;
+const char* nodeKindName(NodeKind kind);
 
-class Header: public Node {
-public:
-    Header(int size, std::vector<Node*> children) {
-        this->size = size;
-        this->children = children;
-    }
-    ~Header() {}
-    virtual std::string getString();
-
-private:
-    int size;
-    std::vector<Node*> children;
+// Byte range of the source text
+struct Span {
+    uint32_t offset;
+    uint32_t length;
 };
 
-
-class Paragraph: public Node {
-public:
-    Paragraph(std::vector<Node*> children) {
-        this->children = children;
-    }
-    ~Paragraph() {}
-    virtual std::string getString();
-
-private:
-    std::vector<Node*> children;
+constexpr uint32_t NoNode = UINT32_MAX;
+
+// Fixed-size node record. A tree is one array of these in pre-order: a node
+// comes before its children, which come before its next sibling, so walking
+// the tree touches the array front to back. Text is referenced by offset
+// rather than pointer, so a tree can be copied or written out as raw bytes.
+struct Node {
+    NodeKind kind;
+    uint8_t level;
+    Span text;
+    Span url;
+    uint32_t firstChild;
+    uint32_t nextSibling;
 };
 
-
-class CodeBlock: public Node {
-public:
-    CodeBlock(std::string text) {
-        this->text = text;
-    }
-    ~CodeBlock() {}
-    virtual std::string getString();
-
-private:
-    std::string text;
+// A header's anchor: the header's node and its id, a range of Tree::ids.
+// Like Node, it holds no pointers, so a list of them can be written out as
+// raw bytes.
+struct Heading {
+    uint32_t node;
+    Span id;
 };
 
-
-class Image: public Node {
-public:
-    Image(std::string text, std::string url) {
-        this->text = text;
-        this->url = url;
-    }
-    ~Image() {}
-    virtual std::string getString();
-
-private:
-    std::string text;
-    std::string url;
+// Read-only view of a parsed tree and the source its spans point into. If
+// the document was parsed with anchors, `headings` lists its headers in
+// order, which is also the table of contents.
+struct Tree {
+    const Node* nodes;
+    size_t nodeCount;
+    const uint32_t* blocks;
+    size_t blockCount;
+    std::string_view source;
+    const Heading* headings = nullptr;
+    size_t headingCount = 0;
+    std::string_view ids;
+
+    std::string_view text(const Node& node) const { return source.substr(node.text.offset, node.text.length); }
+    std::string_view url(const Node& node) const { return source.substr(node.url.offset, node.url.length); }
+    std::string_view id(const Heading& heading) const { return ids.substr(heading.id.offset, heading.id.length); }
+    // The anchor of a Header node, or null without anchors
+    const Heading* heading(const Node& node) const;
 };
 
-
-class Text: public Node {
-public:
-    Text(std::string text) {
-        this->text = text;
+// Visits the subtree under `root` in document order, calling
+// visitor.enter(node) before a node's children and visitor.leave(node) after.
+template<typename Visitor>
+void walk(const Tree& tree, uint32_t root, Visitor& visitor) {
+    uint32_t shallow[32];
+    std::vector<uint32_t> deep;
+    size_t depth = 0;
+
+    uint32_t i = root;
+    for (;;) {
+        const Node& node = tree.nodes[i];
+        visitor.enter(node);
+        if (node.firstChild != NoNode) {
+            if (depth < 32) {
+                shallow[depth] = i;
+            } else {
+                deep.push_back(i);
+            }
+            depth++;
+            i = node.firstChild;
+            continue;
+        }
+        visitor.leave(node);
+        for (;;) {
+            if (depth == 0) {
+                return;
+            }
+            if (tree.nodes[i].nextSibling != NoNode) {
+                i = tree.nodes[i].nextSibling;
+                break;
+            }
+            depth--;
+            if (depth < 32) {
+                i = shallow[depth];
+            } else {
+                i = deep.back();
+                deep.pop_back();
+            }
+            visitor.leave(tree.nodes[i]);
+        }
     }
-    ~Text() {}
-    virtual std::string getString();
-
-private:
-    std::string text;
+}
+
+// Output formats, as visitors for walk() and render(). Each appends to its
+// own buffer; begin() and end() go around the document and endBlock() after
+// each top-level block.
+struct HTMLWriter {
+    OutputBuffer& out;
+    const Tree& tree;
+
+    void begin() {}
+    void enter(const Node& node);
+    void leave(const Node& node);
+    void endBlock() { out.append('\n'); }
+    void end() {}
 };
 
-
-class Italic: public Node {
-public:
-    Italic(std::vector<Node*> children) {
-        this->children = children;
-    }
-    ~Italic() {}
-    virtual std::string getString();
-
-private:
-    std::vector<Node*> children;
+// The text a reader sees, for indexing: no markup, no escaping, image alt
+// text in place of the image, and a blank line after each block
+struct TextWriter {
+    OutputBuffer& out;
+    const Tree& tree;
+
+    void begin() {}
+    void enter(const Node& node);
+    void leave(const Node& node);
+    void endBlock() { out.append("\n\n"); }
+    void end() {}
 };
 
-
-class Bold: public Node {
-public:
-    Bold(std::vector<Node*> children) {
-        this->children = children;
-    }
-    ~Bold() {}
-    virtual std::string getString();
-
-private:
-    std::vector<Node*> children;
+// The tree as JSON: {"blocks": [...]}, each node an object with its "kind",
+// whichever of "level", "text" and "url" it has, and its "children"
+struct JSONWriter {
+    OutputBuffer& out;
+    const Tree& tree;
+    // Whether the next node follows a sibling and needs a comma first
+    bool separate = false;
+
+    void begin();
+    void enter(const Node& node);
+    void leave(const Node& node);
+    void endBlock() {}
+    void end();
 };
 
+// Feeds each node to several writers in turn
+template<typename... Writers>
+struct Fanout {
+    std::tuple<Writers&...> writers;
 
-class Code: public Node {
-public:
-    Code(std::string text) {
-        this->text = text;
-    }
-    ~Code() {}
-    virtual std::string getString();
-
-private:
-    std::string text;
+    void enter(const Node& node) { std::apply([&](Writers&... each) { (each.enter(node), ...); }, writers); }
+    void leave(const Node& node) { std::apply([&](Writers&... each) { (each.leave(node), ...); }, writers); }
 };
 
-
-class Link: public Node {
-public:
-    Link(std::string text, std::string url) {
-        this->text = text;
-        this->url = url;
+// Renders the whole tree to every one of `writers` in a single walk, so
+// each extra format costs its own output and not another traversal. The
+// writer types are fixed at compile time, so nothing is dispatched per node.
+template<typename... Writers>
+void render(const Tree& tree, Writers&... writers) {
+    Fanout<Writers...> fanout{std::tuple<Writers&...>(writers...)};
+    (writers.begin(), ...);
+    for (size_t i = 0; i < tree.blockCount; i++) {
+        walk(tree, tree.blocks[i], fanout);
+        (writers.endBlock(), ...);
     }
-    ~Link() {}
-    virtual std::string getString();
-
-private:
-    std::string text;
-    std::string url;
-};
\ No newline at end of file
+    (writers.end(), ...);
+}
+
+// Writes the headings as a nested list of links to their anchors, each
+// showing its header's text with the header's formatting. Nothing if the
+// tree has no headings.
+void writeTOC(OutputBuffer& out, const Tree& tree);
+
+// Renders one top-level block
+void writeHTML(OutputBuffer& out, const Tree& tree, uint32_t block);
+// Renders every block, each followed by a newline
+void writeHTML(OutputBuffer& out, const Tree& tree);
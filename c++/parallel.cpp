@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <cstring>
+#include "node.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+
+// Ranges smaller than this aren't worth a thread
+static const size_t minRange = 64 * 1024;
+
+// Offsets of the backtick runs the lexer will read as fences. Runs of
+// special characters lex as one token, so a fence is exactly three
+// backticks with no other special character stuck to either side.
+static std::vector<size_t> findFences(std::string_view source) {
+    std::vector<size_t> fences;
+    const char* base = source.data();
+    const char* end = base + source.length();
+    const char* p = base;
+    while ((p = static_cast<const char*>(memchr(p, '`', end - p)))) {
+        const char* q = p;
+        while (q < end && *q == '`') {
+            q++;
+        }
+        bool joinsBefore = p > base && isSpecialChar(p[-1]);
+        bool joinsAfter = q < end && isSpecialChar(*q) && !strchr("#[(!", *q);
+        if (q - p == 3 && !joinsBefore && !joinsAfter) {
+            fences.push_back(p - base);
+        }
+        p = q;
+    }
+    return fences;
+}
+
+// Top-level newlines parse to nothing, so blocks can be compared by where
+// their first real token is
+static size_t skipNewlines(std::string_view source, size_t pos) {
+    while (pos < source.length() && source[pos] == '\n') {
+        pos++;
+    }
+    return pos;
+}
+
+// Cuts the source into ranges at line starts outside fenced code. A line
+// start is always a token boundary, except after a `#`, which swallows the
+// newline that follows it.
+size_t ParallelConverter::split(std::string_view source, size_t ranges) {
+    this->source = source;
+    pieces.clear();
+    reparsed.clear();
+    segments.clear();
+    errorPiece = nullptr;
+
+    size_t length = source.length();
+    ranges = std::min(ranges, length / minRange);
+    if (mayDefineReferences(source)) {
+        // A piece would only see the definitions inside it
+        ranges = 1;
+    }
+    std::vector<size_t> fences;
+    if (ranges > 1) {
+        fences = findFences(source);
+    }
+
+    size_t begin = 0;
+    for (size_t r = 1; r < ranges; r++) {
+        size_t cut = r * length / ranges;
+        while (cut < length) {
+            const char* newline = static_cast<const char*>(memchr(source.data() + cut, '\n', length - cut));
+            if (!newline) {
+                cut = length;
+                break;
+            }
+            cut = newline - source.data() + 1;
+            size_t fencesBefore = std::lower_bound(fences.begin(), fences.end(), cut) - fences.begin();
+            if (fencesBefore % 2 == 1) {
+                // Inside a code block: carry on from its closing fence
+                cut = fencesBefore < fences.size() ? fences[fencesBefore] : length;
+                continue;
+            }
+            if (cut < 2 || source[cut - 2] != '#') {
+                break;
+            }
+        }
+        if (cut >= length) {
+            break;
+        }
+        if (cut > begin) {
+            pieces.emplace_back();
+            pieces.back().begin = begin;
+            pieces.back().end = cut;
+            begin = cut;
+        }
+    }
+    pieces.emplace_back();
+    pieces.back().begin = begin;
+    pieces.back().end = length;
+    return pieces.size();
+}
+
+void ParallelConverter::render(size_t piece, Document& document) {
+    render(pieces[piece], piece + 1 == pieces.size(), document);
+}
+
+// Parses and renders one range. Unless it's the last, blocks that reach the
+// end of the range are left out, as they may carry on into the next one.
+void ParallelConverter::render(Piece& piece, bool final, Document& document) {
+    TraceSpan span("piece", "piece");
+    if (span.recording()) {
+        span.setArgs("\"begin\": " + std::to_string(piece.begin) + ", \"end\": " + std::to_string(piece.end));
+    }
+    Parser parser(source.substr(piece.begin, piece.end - piece.begin), document);
+    piece.consumed = piece.begin + parser.parseBlocks(final);
+
+    Tree tree = document.tree();
+    StringSink sink(piece.html);
+    OutputBuffer out(sink);
+    for (size_t i = 0; i < tree.blockCount; i++) {
+        writeHTML(out, tree, tree.blocks[i]);
+        out.append('\n');
+        piece.starts.push_back(piece.begin + document.blockOffsets()[i]);
+        piece.htmlEnds.push_back(out.written());
+    }
+    out.flush();
+    piece.errors = document.diagnostics();
+}
+
+// Takes blocks [first, last) of a piece into the output
+void ParallelConverter::adopt(const Piece& piece, size_t first, size_t last) {
+    if (first == last) {
+        return;
+    }
+    segments.push_back(Segment{&piece.html, first > 0 ? piece.htmlEnds[first - 1] : 0, piece.htmlEnds[last - 1]});
+    if (errorPiece) {
+        return;
+    }
+    for (const Diagnostic& diagnostic : piece.errors) {
+        if (diagnostic.block >= first && diagnostic.block < last) {
+            firstError = diagnostic;
+            errorPiece = &piece;
+            break;
+        }
+    }
+}
+
+bool ParallelConverter::convert(std::string_view source, ThreadPool& pool, const Limits& limits) {
+    size_t count = split(source, size_t(pool.size()) * 4);
+    std::vector<Document> documents(pool.size());
+    for (Document& document : documents) {
+        document.setLimits(limits);
+    }
+    for (size_t i = 0; i < count; i++) {
+        pool.submit([this, i, &documents](unsigned worker) {
+            render(i, documents[worker]);
+        });
+    }
+    pool.wait();
+    return stitch(documents[0]);
+}
+
+bool ParallelConverter::stitch(Document& document) {
+    TraceSpan span("piece", "stitch");
+    // `pos` is where the next block really starts. A piece can be taken
+    // from there on if it started a block at the same place, since the
+    // parser carries nothing else between blocks.
+    size_t pos = skipNewlines(source, 0);
+    for (size_t j = 0; j < pieces.size(); j++) {
+        const Piece& piece = pieces[j];
+        bool final = j + 1 == pieces.size();
+        if (pos >= piece.end) {
+            continue;
+        }
+        size_t first = std::lower_bound(piece.starts.begin(), piece.starts.end(), pos) - piece.starts.begin();
+        bool synced = pos == skipNewlines(source, piece.begin) || (first < piece.starts.size() && piece.starts[first] == pos);
+        if (!synced) {
+            // The cut fell inside a block. Parse from the true boundary up
+            // to the first block the piece agrees with.
+            reparsed.emplace_back();
+            Piece& head = reparsed.back();
+            head.begin = pos;
+            head.end = piece.end;
+            render(head, final, document);
+            size_t k = 0;
+            while (k < head.starts.size() && !std::binary_search(piece.starts.begin(), piece.starts.end(), head.starts[k])) {
+                k++;
+            }
+            adopt(head, 0, k);
+            if (k == head.starts.size()) {
+                pos = skipNewlines(source, head.consumed);
+                continue;
+            }
+            pos = head.starts[k];
+            first = std::lower_bound(piece.starts.begin(), piece.starts.end(), pos) - piece.starts.begin();
+        }
+        adopt(piece, first, piece.starts.size());
+        pos = skipNewlines(source, piece.consumed);
+    }
+
+    if (errorPiece) {
+        // Piece positions count from 1:1 at the start of the piece
+        int line = 1;
+        int col = 1;
+        advancePosition(line, col, source.substr(0, errorPiece->begin));
+        if (firstError.line == 1) {
+            firstError.col += col - 1;
+        }
+        firstError.line += line - 1;
+        return false;
+    }
+    return true;
+}
+
+void ParallelConverter::write(OutputBuffer& out) const {
+    for (const Segment& segment : segments) {
+        out.append(segment.html->data() + segment.begin, segment.end - segment.begin);
+    }
+}
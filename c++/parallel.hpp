@@ -0,0 +1,65 @@
+#pragma once
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "parser.hpp"
+#include "pool.hpp"
+#include "sink.hpp"
+
+// Converts one document on several threads. A pre-scan cuts the input at
+// line starts that look like block boundaries (outside fenced code), and
+// each range is parsed and rendered on its own thread. The pieces are then
+// stitched together in order. Where a cut turns out to fall inside a block,
+// stitching re-parses from the last real block boundary until it meets a
+// block the piece agrees on, so the output is always byte-identical to a
+// single-threaded conversion.
+class ParallelConverter {
+public:
+    // Converts `source` on `pool`. Returns false if the document has parse
+    // errors; the first is in error(). Of `limits`, only nesting means the
+    // same for a piece as for the whole document, so the rest had better be 0.
+    bool convert(std::string_view source, ThreadPool& pool, const Limits& limits = Limits());
+
+    // The steps of convert(), for callers that schedule the work themselves.
+    // split() returns how many pieces there are (at most `ranges`); they can
+    // be rendered in any order and concurrently, each with its own Document.
+    size_t split(std::string_view source, size_t ranges);
+    void render(size_t piece, Document& document);
+    bool stitch(Document& document);
+
+    const Diagnostic& error() const { return firstError; }
+    // Writes the HTML stitched together by the last convert() or stitch()
+    void write(OutputBuffer& out) const;
+
+private:
+    // A range of the source parsed and rendered on its own
+    struct Piece {
+        size_t begin;
+        size_t end;
+        // End of the last block that didn't run into the end of the range
+        size_t consumed;
+        // Source offset and end of the HTML of each block
+        std::vector<size_t> starts;
+        std::vector<size_t> htmlEnds;
+        std::string html;
+        // Positions are relative to `begin`
+        std::vector<Diagnostic> errors;
+    };
+
+    struct Segment {
+        const std::string* html;
+        size_t begin;
+        size_t end;
+    };
+
+    void render(Piece& piece, bool final, Document& document);
+    void adopt(const Piece& piece, size_t first, size_t last);
+
+    std::string_view source;
+    std::vector<Piece> pieces;
+    std::deque<Piece> reparsed;
+    std::vector<Segment> segments;
+    Diagnostic firstError;
+    const Piece* errorPiece = nullptr;
+};
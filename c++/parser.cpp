@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <cstring>
+#include <sstream>
 #include "node.hpp"
 #include "parser.hpp"
+#include "scan.hpp"
+#include "trace.hpp"
 
 bool isSpecialChar(char c) {
     return c == '_' ||
@@ -13,154 +18,734 @@ bool isSpecialChar(char c) {
 		c == '!';
 }
 
-Token* Parser::pop() {
-    index += 1;
-    if (index >= tokens.size() - 1) {
+TokenKind classifyToken(std::string_view data) {
+    if (data.length() == 1) {
+        switch (data[0]) {
+        case '#': return TokenKind::Hash;
+        case '*': return TokenKind::Star;
+        case '_': return TokenKind::Underscore;
+        case '`': return TokenKind::Backtick;
+        case '[': return TokenKind::LBracket;
+        case ']': return TokenKind::RBracket;
+        case '(': return TokenKind::LParen;
+        case ')': return TokenKind::RParen;
+        case '!': return TokenKind::Bang;
+        case '\n': return TokenKind::Newline;
+        }
+    } else if (data == "**") {
+        return TokenKind::DoubleStar;
+    } else if (data == "__") {
+        return TokenKind::DoubleUnderscore;
+    } else if (data == "```") {
+        return TokenKind::Fence;
+    }
+    return TokenKind::Text;
+}
+
+const char* tokenKindName(TokenKind kind) {
+    switch (kind) {
+    case TokenKind::Text: return "text";
+    case TokenKind::Hash: return "#";
+    case TokenKind::Fence: return "```";
+    case TokenKind::Star: return "*";
+    case TokenKind::DoubleStar: return "**";
+    case TokenKind::Underscore: return "_";
+    case TokenKind::DoubleUnderscore: return "__";
+    case TokenKind::Backtick: return "`";
+    case TokenKind::LBracket: return "[";
+    case TokenKind::RBracket: return "]";
+    case TokenKind::LParen: return "(";
+    case TokenKind::RParen: return ")";
+    case TokenKind::Bang: return "!";
+    case TokenKind::Newline: return "\\n";
+    }
+    return "?";
+}
+
+Tree Document::tree() const {
+    return Tree{nodes.data(), nodes.size(), topLevel.data(), topLevel.size(), source, anchorList.data(), anchorList.size(), ids};
+}
+
+void Document::reset() {
+    source = {};
+    tokens.clear();
+    nodes.clear();
+    topLevel.clear();
+    topLevelOffsets.clear();
+    errors.clear();
+    definitions.clear();
+    anchorList.clear();
+    ids.clear();
+    slugs.clear();
+}
+
+static char lower(char c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// FNV-1a over the label with ASCII letters lowercased
+static uint64_t hashLabel(std::string_view label) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : label) {
+        hash = (hash ^ uint8_t(lower(c))) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static bool sameLabel(std::string_view a, std::string_view b) {
+    if (a.length() != b.length()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.length(); i++) {
+        if (lower(a[i]) != lower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void References::clear() {
+    if (count > 0) {
+        std::fill(slots.begin(), slots.end(), Slot());
+        count = 0;
+    }
+}
+
+void References::grow() {
+    std::vector<Slot> old(std::max<size_t>(16, slots.size() * 2));
+    old.swap(slots);
+    size_t mask = slots.size() - 1;
+    for (const Slot& slot : old) {
+        if (!slot.label.empty()) {
+            size_t i = slot.hash & mask;
+            while (!slots[i].label.empty()) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = slot;
+        }
+    }
+}
+
+void References::define(std::string_view label, std::string_view url) {
+    if ((count + 1) * 2 > slots.size()) {
+        grow();
+    }
+    uint64_t hash = hashLabel(label);
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Slot& slot = slots[i];
+        if (slot.label.empty()) {
+            slot = Slot{hash, label, url};
+            count++;
+            return;
+        }
+        if (slot.hash == hash && sameLabel(slot.label, label)) {
+            return;
+        }
+    }
+}
+
+const std::string_view* References::find(std::string_view label) const {
+    if (count == 0) {
         return nullptr;
-    } else {
-        return tokens.at(index - 1);
     }
+    uint64_t hash = hashLabel(label);
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask; !slots[i].label.empty(); i = (i + 1) & mask) {
+        if (slots[i].hash == hash && sameLabel(slots[i].label, label)) {
+            return &slots[i].url;
+        }
+    }
+    return nullptr;
+}
+
+bool mayDefineReferences(std::string_view source) {
+    return source.find("]:") != std::string_view::npos;
+}
+
+Parser::Parser(std::string_view content, Document& document, int firstLine, int firstCol) : document(document), tokens(document.tokens), nodes(document.nodes) {
+    document.reset();
+    document.source = content;
+    index = 0;
+    tracing = Trace::enabled();
+    const Limits& limits = document.limits();
+    maxNesting = limits.nesting ? limits.nesting : SIZE_MAX;
+    maxNodes = limits.nodes ? limits.nodes : SIZE_MAX;
+    // Spans are 32-bit, so that much is a hard cap whatever the limits say
+    size_t maxInput = limits.inputBytes && limits.inputBytes < UINT32_MAX - 1 ? limits.inputBytes : UINT32_MAX - 1;
+    size_t maxTokens = limits.tokens ? limits.tokens : SIZE_MAX;
+
+    const char* base = content.data();
+    size_t length = content.length();
+    if (length > maxInput) {
+        document.errors.push_back(Diagnostic{firstLine, firstCol, "", "", 0, "input is larger than " + std::to_string(maxInput) + " bytes"});
+        cut = true;
+        length = 0;
+    }
+    size_t i = 0;
+    // Whether any `]:` turned up, which a definition needs
+    bool colons = false;
+    int line = firstLine;
+    ptrdiff_t lineStart = 1 - firstCol;
+    while (i < length) {
+        size_t start = i;
+        char c = content[i];
+        if (tokens.size() == maxTokens) {
+            document.errors.push_back(Diagnostic{line, int(ptrdiff_t(start) - lineStart + 1), "", "", 0, "more than " + std::to_string(maxTokens) + " tokens"});
+            cut = true;
+            length = start;
+            break;
+        }
+        if (c == '\n') {
+            i++;
+        } else if (!isSpecialChar(c)) {
+            // Plain text runs to the next special character or newline; this
+            // is where nearly all of the input goes, so skip it a vector at a time
+            i = findSpecial(base + i + 1, base + length) - base;
+            colons = colons || (c == ':' && start > 0 && content[start - 1] == ']');
+        } else {
+            // Runs of special characters break before any of `#[(!`
+            i++;
+            while (i < length && isSpecialChar(content[i]) && content[i] != '#' && content[i] != '[' && content[i] != '(' && content[i] != '!') {
+                i++;
+            }
+        }
+        std::string_view data = content.substr(start, i - start);
+        tokens.push_back(Token{data, classifyToken(data), line, int(ptrdiff_t(start) - lineStart + 1)});
+        if (c == '\n') {
+            line++;
+            lineStart = i;
+        }
+        // The whitespace character straight after a `#` is dropped
+        if (content[i - 1] == '#' && i < length && isspace(content[i])) {
+            if (content[i] == '\n') {
+                line++;
+                lineStart = i + 1;
+            }
+            i++;
+        }
+    }
+    // Sentinel: an empty newline at the end of the input, or where lexing stopped
+    tokens.push_back(Token{content.substr(length, 0), TokenKind::Newline, line, int(ptrdiff_t(length) - lineStart + 1)});
+    if (colons) {
+        collectReferences();
+    }
+}
+
+// Definitions can come after the links that use them, so they're all
+// collected before parsing starts. Blocks start where parseNode would start
+// them, and fenced code is skipped.
+void Parser::collectReferences() {
+    size_t last = tokens.size() - 1;
+    size_t i = 0;
+    while (i < last) {
+        TokenKind kind = tokens[i].kind;
+        if (kind == TokenKind::Newline) {
+            i++;
+            continue;
+        }
+        if (kind == TokenKind::Fence) {
+            i++;
+            while (i < last && tokens[i].kind != TokenKind::Fence) {
+                i++;
+            }
+            // Another block can start straight after the closing fence
+            if (i < last) {
+                i++;
+            }
+            continue;
+        }
+        std::string_view label;
+        std::string_view url;
+        if (definitionAt(i, label, url)) {
+            document.definitions.define(label, url);
+        }
+        while (i < last && tokens[i].kind != TokenKind::Newline) {
+            i++;
+        }
+    }
+}
+
+// Index of the `]` that closes a label starting at token `i`, or 0 if the
+// line, or another `[`, comes first, or the label is empty
+size_t Parser::labelEnd(size_t i) {
+    size_t start = i;
+    for (; i < tokens.size() - 1; i++) {
+        switch (tokens[i].kind) {
+        case TokenKind::RBracket:
+            return i > start ? i : 0;
+        case TokenKind::LBracket:
+        case TokenKind::Newline:
+            return 0;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+// Whether the block at token `i` is a `[label]: url` definition. The URL is
+// the first word after the colon; anything after it, like a title, is ignored.
+bool Parser::definitionAt(size_t i, std::string_view& label, std::string_view& url) {
+    if (tokens[i].kind != TokenKind::LBracket) {
+        return false;
+    }
+    size_t close = labelEnd(i + 1);
+    if (close == 0 || close + 1 >= tokens.size() - 1) {
+        return false;
+    }
+    const Token& rest = tokens[close + 1];
+    if (rest.kind != TokenKind::Text || rest.data[0] != ':') {
+        return false;
+    }
+    const char* begin = tokens[i + 1].data.data();
+    label = std::string_view(begin, tokens[close].data.data() - begin);
+    const char* p = rest.data.data() + 1;
+    const char* end = tokens.back().data.data();
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    const char* start = p;
+    while (p < end && !isspace(uint8_t(*p))) {
+        p++;
+    }
+    url = std::string_view(start, p - start);
+    return !url.empty();
 }
 
+Token* Parser::pop() {
+    Token* top = &tokens[index];
+    if (!atEnd()) {
+        index += 1;
+    }
+    return top;
+}
+
+// Looking at the sentinel is recorded in sawEnd: when parsing a piece of a
+// larger input, whatever was parsed after that might change with more text
 Token* Parser::peek() {
+    if (index == tokens.size() - 1) {
+        sawEnd = true;
+    }
+    return &tokens[index];
+}
+
+bool Parser::atEnd() {
     if (index >= tokens.size() - 1) {
-        return nullptr;
-    } else {
-        return tokens.at(index);
+        sawEnd = true;
+        return true;
     }
+    return false;
 }
 
-Token* Parser::accept(std::string data) {
-    if (peek()->data == data) {
+Token* Parser::accept(TokenKind kind) {
+    if (!atEnd() && peek()->kind == kind) {
         return pop();
     } else {
         return nullptr;
     }
 }
 
-void Parser::expect(std::string data) {
-    if (!accept(data)) {
+void Parser::expect(TokenKind kind) {
+    if (!accept(kind)) {
+        if (limited || (cut && atEnd())) {
+            // Whatever comes up short after a cap was hit is the cap's doing
+            return;
+        }
+        if (!final && atEnd()) {
+            // Not an error yet; parseBlocks discards this block and waits for more input
+            return;
+        }
         Token* top = peek();
-        if (isSpecialChar(top->data.at(0))) {
-            std::cerr << "error: " << top->line << ":" << top->col << " expected `" << data << "`, got " << top->data << std::endl;
+        std::string got;
+        if (atEnd()) {
+            got = "end of input";
+        } else if (isSpecialChar(top->data.at(0))) {
+            got = std::string(top->data);
         } else {
-            std::cerr << "error: " << top->line << ":" << top->col << " expected `" << data << "`, got text" << std::endl;
+            got = "text";
         }
-        exit(1);
+        document.errors.push_back(Diagnostic{top->line, top->col, tokenKindName(kind), got, document.topLevel.size(), ""});
+    }
+}
+
+void printDiagnostic(std::ostream& out, const Diagnostic& diagnostic) {
+    if (!diagnostic.limit.empty()) {
+        out << "error: " << diagnostic.line << ":" << diagnostic.col << " " << diagnostic.limit << std::endl;
+        return;
     }
+    out << "error: " << diagnostic.line << ":" << diagnostic.col << " expected `" << diagnostic.expected << "`, got " << diagnostic.got << std::endl;
+}
+
+void advancePosition(int& line, int& col, std::string_view text) {
+    const char* p = text.data();
+    const char* end = p + text.length();
+    const char* lineStart = p;
+    while (const char* newline = static_cast<const char*>(memchr(p, '\n', end - p))) {
+        line++;
+        col = 1;
+        p = lineStart = newline + 1;
+    }
+    col += int(end - lineStart);
+}
+
+// Consumes tokens up to and including `sentinel` (or the end of input) and
+// returns the source text between them. Tokens are adjacent slices of the
+// input, so this is a single view rather than a concatenation.
+std::string_view Parser::takeUntil(TokenKind sentinel) {
+    const char* begin = peek()->data.data();
+    const char* end = begin;
+    while (!atEnd() && !accept(sentinel)) {
+        Token* token = pop();
+        end = token->data.data() + token->data.length();
+    }
+    return std::string_view(begin, end - begin);
+}
+
+// Records the span with the line it's on, which in a piece of a larger
+// input counts from the start of the piece
+void Parser::traceInline(const char* name, const Token& first, Trace::Time begin) {
+    auto end = std::chrono::steady_clock::now();
+    const char* source = document.source.data();
+    const char* at = first.data.data();
+    const char* lineStart = at;
+    while (lineStart > source && lineStart[-1] != '\n') {
+        lineStart--;
+    }
+    size_t length = std::string_view(lineStart, source + document.source.length() - lineStart).find('\n');
+    std::string_view line(lineStart, std::min<size_t>(length, 120));
+    std::ostringstream args;
+    args << "\"line\": " << first.line << ", \"source\": ";
+    writeJSONString(args, line);
+    Trace::span(name, "inline", begin, end, args.str());
+}
+
+// Parses the text of a header or paragraph
+void Parser::parseInline(uint32_t block) {
+    sampling = tracing && blocksSeen++ % inlineSampleRate == 0;
+    if (!sampling) {
+        parseFormattedText(block);
+        return;
+    }
+    const Token& first = *peek();
+    Trace::Time begin = std::chrono::steady_clock::now();
+    parseFormattedText(block);
+    traceInline("inline", first, begin);
+}
+
+uint32_t Parser::addNode(NodeKind kind, std::string_view text, std::string_view url) {
+    // Past the cap there's no node to give; callers leave it out, and the
+    // parse is at its end by then anyway
+    if (nodes.size() >= maxNodes) {
+        if (!limited) {
+            overLimit(tokens[index], "more than " + std::to_string(maxNodes) + " nodes");
+        }
+        return NoNode;
+    }
+    nodes.push_back(Node{kind, 0, span(text), span(url), NoNode, NoNode});
+    return nodes.size() - 1;
+}
+
+Span Parser::span(std::string_view text) {
+    if (text.empty()) {
+        return Span{0, 0};
+    }
+    return Span{uint32_t(text.data() - document.source.data()), uint32_t(text.length())};
+}
+
+Document& Parser::parseDocument() {
+    parseBlocks(true);
+    return document;
 }
 
-std::vector<Node*> Parser::parseDocument() {
-    std::vector<Node*> retval;
+// Parses top-level blocks and returns how many bytes of the input they
+// cover. Unless `final` is set the input is taken to be cut short: a block
+// that looks at the end of input is dropped, along with everything after it,
+// so that every block kept parses the same as it would with the rest of the
+// text present. The input must end on a newline for that to hold, so that
+// the last token is complete.
+size_t Parser::parseBlocks(bool final) {
+    this->final = final;
     while (index < tokens.size() - 1) {
-        Node* node = parseNode();
-        if(node) {
-            retval.push_back(node);
+        size_t start = index;
+        size_t nodeCount = nodes.size();
+        size_t errorCount = document.errors.size();
+        sawEnd = false;
+        uint32_t node = parseNode();
+        if (limited) {
+            // Keep what was parsed of the block the cap cut short
+            if (node != NoNode) {
+                document.topLevel.push_back(node);
+                document.topLevelOffsets.push_back(tokens[start].data.data() - document.source.data());
+            }
+            break;
+        }
+        if (!final && sawEnd) {
+            index = start;
+            nodes.resize(nodeCount);
+            document.errors.resize(errorCount);
+            while (!document.anchorList.empty() && document.anchorList.back().node >= nodeCount) {
+                const Heading& dropped = document.anchorList.back();
+                document.slugs.erase(document.ids.substr(dropped.id.offset, dropped.id.length));
+                document.ids.resize(dropped.id.offset);
+                document.anchorList.pop_back();
+            }
+            break;
+        }
+        if (node != NoNode) {
+            document.topLevel.push_back(node);
+            document.topLevelOffsets.push_back(tokens[start].data.data() - document.source.data());
         }
     }
-    return retval;
+    return tokens[index].data.data() - document.source.data();
 }
 
-Node* Parser::parseNode() {
-    if (accept("#")) {
+uint32_t Parser::parseNode() {
+    switch (peek()->kind) {
+    case TokenKind::Hash:
+        pop();
         return parseHeader();
-    } else if (accept("```")) {
+    case TokenKind::Fence:
+        pop();
         return parseCodeBlock();
-    } else if (accept("!")) {
+    case TokenKind::Bang:
+        pop();
         return parseImage();
-    } else if (accept("\n")) {
-        return nullptr;
-    } else {
+    case TokenKind::Newline:
+        pop();
+        return NoNode;
+    case TokenKind::LBracket: {
+        std::string_view label;
+        std::string_view url;
+        if (definitionAt(index, label, url)) {
+            // Already collected; a definition renders as nothing
+            while (!atEnd() && pop()->kind != TokenKind::Newline) {
+            }
+            return NoNode;
+        }
+        return parseParagraph();
+    }
+    default:
         return parseParagraph();
     }
 }
 
-Header* Parser::parseHeader() {
+uint32_t Parser::parseHeader() {
     int size = 1;
-    while (accept("#")) {
+    while (accept(TokenKind::Hash)) {
         size++;
     }
-    std::set<std::string> bounds = {"\n"};
-    return new Header{size, parseFormattedText(bounds)};
+    uint32_t header = addNode(NodeKind::Header);
+    if (header == NoNode) {
+        return NoNode;
+    }
+    nodes[header].level = size;
+    parseInline(header);
+    if (document.anchors) {
+        addAnchor(header);
+    }
+    return header;
 }
 
-Paragraph* Parser::parseParagraph() {
-    std::set<std::string> bounds = {"\n"};
-    return new Paragraph{parseFormattedText(bounds)};
+// Makes an id from the text under the header, which is every node added
+// since it: letters and digits lowercased, spaces and hyphens as hyphens,
+// underscores and anything outside ASCII kept, other punctuation dropped.
+// An id that's been given out already gets -1, -2 and so on added.
+void Parser::addAnchor(uint32_t header) {
+    std::string slug;
+    for (size_t i = header + 1; i < nodes.size(); i++) {
+        const Node& node = nodes[i];
+        if (node.kind != NodeKind::Text && node.kind != NodeKind::Code && node.kind != NodeKind::Link) {
+            continue;
+        }
+        for (char c : document.source.substr(node.text.offset, node.text.length)) {
+            if (isalnum(uint8_t(c))) {
+                slug += char(tolower(uint8_t(c)));
+            } else if (c == ' ' || c == '-') {
+                slug += '-';
+            } else if (c == '_' || uint8_t(c) >= 0x80) {
+                slug += c;
+            }
+        }
+    }
+    if (slug.empty()) {
+        slug = "section";
+    }
+    std::string id = slug;
+    for (int n = 1; !document.slugs.insert(id).second; n++) {
+        id = slug + "-" + std::to_string(n);
+    }
+    document.anchorList.push_back(Heading{header, Span{uint32_t(document.ids.length()), uint32_t(id.length())}});
+    document.ids += id;
 }
 
-CodeBlock* Parser::parseCodeBlock() {
-    std::string text = "";
-    while (!accept("```")) {
-        text += pop()->data;
+uint32_t Parser::parseParagraph() {
+    uint32_t paragraph = addNode(NodeKind::Paragraph);
+    if (paragraph == NoNode) {
+        return NoNode;
     }
-    return new CodeBlock{text};
+    parseInline(paragraph);
+    return paragraph;
 }
 
-Image* Parser::parseImage() {
-    expect("[");
-    std::string text = pop()->data;
-    expect("]");
-    expect("(");
-    std::string url = pop()->data;
-    expect(")");
-    return new Image{text, url};
+uint32_t Parser::parseCodeBlock() {
+    return addNode(NodeKind::CodeBlock, takeUntil(TokenKind::Fence));
 }
 
-std::vector<Node*> Parser::parseFormattedText(std::set<std::string> bounds) {
-    std::vector<Node*> retval;
+uint32_t Parser::parseImage() {
+    // parseNode has just taken the `!`
+    const Token& bang = tokens[index - 1];
+    expect(TokenKind::LBracket);
+    std::string_view text = pop()->data;
+    expect(TokenKind::RBracket);
+    if (peek()->kind == TokenKind::LBracket || peek()->data == "[]") {
+        return parseReference(NodeKind::Image, bang, text);
+    }
+    expect(TokenKind::LParen);
+    std::string_view url = pop()->data;
+    expect(TokenKind::RParen);
+    return addNode(NodeKind::Image, text, url);
+}
 
-    while (bounds.find(peek()->data) == bounds.end()) { // While bounds does not contain the front of the token queue
-        if (accept("_") || accept("*")) {
-            retval.push_back(parseItalic(bounds));
-        } else if (accept("__") || accept("**")) {
-            retval.push_back(parseBold(bounds));
-        } else if (accept("`")) {
-            retval.push_back(parseCode());
-        } else if (accept("[")) {
-            retval.push_back(parseLink());
-        } else {
-            retval.push_back(new Text{pop()->data});
+// Parses children onto `parent` up to the end of the line. Emphasis is
+// matched on a stack of open delimiters rather than by recursion: a
+// delimiter closes the innermost open emphasis of its kind, or else opens
+// one. An emphasis still open at the end of the line, or left open inside
+// one that closes around it, was never matched, and goes back to being
+// literal text. Each token is looked at once and the stack holds at most one
+// emphasis of each kind, so this takes linear time and constant space.
+void Parser::parseFormattedText(uint32_t parent) {
+    openers[0] = Opener{parent, NoNode, nullptr, {}};
+    openCount = 1;
+    while (peek()->kind != TokenKind::Newline) {
+        Token* token = pop();
+        switch (token->kind) {
+        case TokenKind::Star:
+        case TokenKind::Underscore:
+            delimiter(*token, NodeKind::Italic);
+            break;
+        case TokenKind::DoubleStar:
+        case TokenKind::DoubleUnderscore:
+            delimiter(*token, NodeKind::Bold);
+            break;
+        case TokenKind::Backtick:
+            appendChild(parseCode());
+            break;
+        case TokenKind::LBracket:
+            appendChild(parseLink());
+            break;
+        default:
+            appendChild(addNode(NodeKind::Text, token->data));
+            break;
         }
     }
-    return retval;
+    while (openCount > 1) {
+        unmatched();
+    }
 }
 
-Italic* Parser::parseItalic(std::set<std::string> bounds) {
-    std::set<std::string> newBounds = bounds;
-    newBounds.insert("*");
-    newBounds.insert("_");
-    std::vector<Node*> children = parseFormattedText(newBounds);
-    if (!accept("*")) {
-        expect("_");
+void Parser::delimiter(const Token& token, NodeKind kind) {
+    for (size_t i = openCount - 1; i > 0; i--) {
+        if (nodes[openers[i].node].kind == kind) {
+            while (openCount > i + 1) {
+                unmatched();
+            }
+            if (sampling) {
+                traceInline(kind == NodeKind::Italic ? "italic" : "bold", *openers[i].token, openers[i].begin);
+            }
+            openCount--;
+            return;
+        }
+    }
+    if (openCount > maxNesting) {
+        appendChild(addNode(NodeKind::Text, token.data));
+        return;
+    }
+    uint32_t node = addNode(kind);
+    if (node == NoNode) {
+        return;
     }
-    return new Italic{children};
+    appendChild(node);
+    openers[openCount++] = Opener{node, NoNode, &token, sampling ? std::chrono::steady_clock::now() : Trace::Time()};
 }
 
-Bold* Parser::parseBold(std::set<std::string> bounds) {
-    std::set<std::string> newBounds = bounds;
-    newBounds.insert("**");
-    newBounds.insert("__");
-    std::vector<Node*> children = parseFormattedText(newBounds);
-    if (!accept("**")) {
-        expect("__");
+void Parser::appendChild(uint32_t child) {
+    if (child == NoNode) {
+        return;
+    }
+    Opener& top = openers[openCount - 1];
+    if (top.last == NoNode) {
+        nodes[top.node].firstChild = child;
+    } else {
+        nodes[top.last].nextSibling = child;
     }
-    return new Bold{children};
+    top.last = child;
+}
+
+// Records that a cap was hit at `at` and skips to the end of the input, so
+// that everything still being parsed winds up at once
+void Parser::overLimit(const Token& at, const std::string& limit) {
+    document.errors.push_back(Diagnostic{at.line, at.col, "", "", document.topLevel.size(), limit});
+    limited = true;
+    index = tokens.size() - 1;
+}
+
+// Turns the innermost open emphasis back into its delimiter as text, with
+// what it held following on as siblings
+void Parser::unmatched() {
+    const Opener& opener = openers[--openCount];
+    Node& node = nodes[opener.node];
+    node.kind = NodeKind::Text;
+    node.text = span(opener.token->data);
+    node.nextSibling = node.firstChild;
+    node.firstChild = NoNode;
+    openers[openCount - 1].last = opener.last != NoNode ? opener.last : opener.node;
 }
 
-Code* Parser::parseCode() {
-    std::string text = "";
-    while (!accept("`")) {
-        text += pop()->data;
+uint32_t Parser::parseCode() {
+    return addNode(NodeKind::Code, takeUntil(TokenKind::Backtick));
+}
+
+uint32_t Parser::parseLink() {
+    // parseFormattedText has just taken the `[`
+    const Token& open = tokens[index - 1];
+    std::string_view text = pop()->data;
+    expect(TokenKind::RBracket);
+    if (peek()->kind == TokenKind::LBracket || peek()->data == "[]") {
+        return parseReference(NodeKind::Link, open, text);
     }
-    return new Code{text};
+    expect(TokenKind::LParen);
+    std::string_view url = pop()->data;
+    expect(TokenKind::RParen);
+    return addNode(NodeKind::Link, text, url);
 }
 
-Link* Parser::parseLink() {
-    std::string text = pop()->data;
-    expect("]");
-    expect("(");
-    std::string url = pop()->data;
-    expect(")");
-    return new Link(text, url);
-}
\ No newline at end of file
+// The `[label]` after a link or image's text, or `[]` to use the text as the
+// label. The URL is looked up in the definitions collected before parsing.
+// A label with no definition leaves everything from `open` on as literal
+// text, in a paragraph of its own for an image.
+uint32_t Parser::parseReference(NodeKind kind, const Token& open, std::string_view text) {
+    std::string_view label = text;
+    // An empty `[]` lexes as one token
+    if (pop()->kind == TokenKind::LBracket) {
+        const char* begin = peek()->data.data();
+        while (!atEnd() && peek()->kind != TokenKind::RBracket && peek()->kind != TokenKind::Newline) {
+            pop();
+        }
+        label = std::string_view(begin, peek()->data.data() - begin);
+        expect(TokenKind::RBracket);
+    }
+    if (const std::string_view* url = document.definitions.find(label)) {
+        return addNode(kind, text, *url);
+    }
+    const Token& last = tokens[index - 1];
+    std::string_view literal(open.data.data(), last.data.data() + last.data.length() - open.data.data());
+    if (kind == NodeKind::Link) {
+        return addNode(NodeKind::Text, literal);
+    }
+    uint32_t paragraph = addNode(NodeKind::Paragraph);
+    if (paragraph != NoNode) {
+        nodes[paragraph].firstChild = addNode(NodeKind::Text, literal);
+    }
+    return paragraph;
+}
@@ -1,69 +1,223 @@
 #pragma once
+#include <chrono>
 #include <iostream>
 #include <string>
-#include <set>
+#include <string_view>
+#include <unordered_set>
 #include <vector>
 #include "node.hpp"
 
 bool isSpecialChar(char c);
 
+// Tokens are classified once by the lexer. Runs of special characters that
+// don't spell one of these (like `***`) are Text.
+enum class TokenKind {
+    Text,
+    Hash,
+    Fence,
+    Star,
+    DoubleStar,
+    Underscore,
+    DoubleUnderscore,
+    Backtick,
+    LBracket,
+    RBracket,
+    LParen,
+    RParen,
+    Bang,
+    Newline,
+};
+
+TokenKind classifyToken(std::string_view data);
+const char* tokenKindName(TokenKind kind);
+
+// A token is a slice of the input buffer; the buffer must outlive the parser
+// and every node built from it.
 struct Token {
-    std::string data;
+    std::string_view data;
+    TokenKind kind;
+    int line;
+    int col;
+};
+
+// A parse error. Parsing carries on past errors, so a document can have
+// several; callers decide whether the result is still usable.
+struct Diagnostic {
     int line;
     int col;
+    std::string expected;
+    std::string got;
+    // Index into Document::blocks() of the block the error is in
+    size_t block;
+    // Says which cap was hit, for an error from Limits rather than syntax
+    std::string limit;
+};
+
+void printDiagnostic(std::ostream& out, const Diagnostic& diagnostic);
+// Moves line:col past `text`
+void advancePosition(int& line, int& col, std::string_view text);
+
+// Caps on what parsing one document may take, so that hostile input costs
+// bounded time and memory; 0 means no cap. Input, tokens and nodes over
+// their cap stop the parse with a diagnostic, leaving the blocks before it.
+// Emphasis nested deeper than `nesting` stays as literal text.
+struct Limits {
+    size_t inputBytes = 0;
+    size_t tokens = 0;
+    size_t nodes = 0;
+    size_t nesting = 0;
+
+    // Whether a cap applies to the document as a whole, which parsing it in
+    // separate pieces can't enforce
+    bool wholeDocument() const { return inputBytes || tokens || nodes; }
+};
+
+// Reference definitions (`[label]: url`) of one document, by label. Open
+// addressing with linear probing, in a power-of-two table kept at most half
+// full; labels match ignoring ASCII case. URLs are slices of the source, so
+// every link to a label shares its definition's text.
+class References {
+public:
+    void clear();
+    // The first definition of a label wins
+    void define(std::string_view label, std::string_view url);
+    // The URL defined for `label`, or null if there isn't one
+    const std::string_view* find(std::string_view label) const;
+    size_t size() const { return count; }
+
+private:
+    struct Slot {
+        uint64_t hash;
+        std::string_view label;
+        std::string_view url;
+    };
+
+    void grow();
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+};
+
+// False if `source` certainly defines no references. A definition ties
+// links anywhere in the document to it, so a source that may have one is
+// parsed whole rather than in pieces.
+bool mayDefineReferences(std::string_view source);
+
+// Result of parsing: a flat tree over the source text. The source isn't
+// copied and must outlive the document. Token, node and block storage keeps
+// its capacity when a Document is reused for another parse, so converting a
+// stream of similar documents with one Document settles into not
+// allocating at all.
+class Document {
+public:
+    Tree tree() const;
+    const std::vector<uint32_t>& blocks() const { return topLevel; }
+    // Source offset each of blocks() starts at
+    const std::vector<uint32_t>& blockOffsets() const { return topLevelOffsets; }
+    const std::vector<Diagnostic>& diagnostics() const { return errors; }
+    const References& references() const { return definitions; }
+    // Only filled in with anchors on; tree() has them too
+    const std::vector<Heading>& headings() const { return anchorList; }
+    void reset();
+
+    // Applies to every parse into this document from now on
+    void setLimits(const Limits& limits) { caps = limits; }
+    const Limits& limits() const { return caps; }
+    // Gives each header an id made from its text, as its anchor, and lists
+    // them in headings() for a table of contents; from the next parse on
+    void setAnchors(bool anchors) { this->anchors = anchors; }
+    bool hasAnchors() const { return anchors; }
+
+private:
+    friend class Parser;
+
+    std::string_view source;
+    std::vector<Token> tokens;
+    std::vector<Node> nodes;
+    std::vector<uint32_t> topLevel;
+    std::vector<uint32_t> topLevelOffsets;
+    std::vector<Diagnostic> errors;
+    References definitions;
+    Limits caps;
+    bool anchors = false;
+    std::vector<Heading> anchorList;
+    // Every id, back to back
+    std::string ids;
+    // The ids given out so far, to keep them unique
+    std::unordered_set<std::string> slugs;
 };
 
 class Parser {
 public:
-    Parser(std::string content) {
-        index = 0;
-        tokens = std::vector<Token*>();
-
-        std::string data = "";
-        data += content[0];
-        int line = 1;
-        int col = 1;
-        int oldCol = 1;
-        char oldC = content.at(0);
-        for (int i = 1; i < content.length(); i ++) {
-            char c = content.at(i);
-            if (data[data.length() - 1] == '\n' || (isSpecialChar(data[data.length() - 1]) != isSpecialChar(c)) || c == '#' || c == '[' || c == '(' || c == '!' || c == '\n') {
-                tokens.push_back(new Token{data, line, oldCol});
-                oldCol = col + 1;
-                if (data.find("\n") != std::string::npos) {
-                    line++;
-                    col = 0;
-                }
-                data = "";
-            }
-            if (oldC != '#' || !isspace(c)) {
-                data.push_back(c);
-            }
-            oldC = c;
-            col += 1;
-        }
-        tokens.push_back(new Token{data, line, oldCol});
-        tokens.push_back(new Token{"\n", line, oldCol});
-    }
-
-    std::vector<Node*> parseDocument();
-    Node* parseNode();
-    Header* parseHeader();
-    Paragraph* parseParagraph();
-    CodeBlock* parseCodeBlock();
-    Image* parseImage();
-    std::vector<Node*> parseFormattedText(std::set<std::string> bounds);
-    Italic* parseItalic(std::set<std::string> bounds);
-    Bold* parseBold(std::set<std::string> bounds);
-    Code* parseCode();
-    Link* parseLink();
+    // `firstLine` and `firstCol` give the position of the start of `content`,
+    // for error messages when it is a piece of a larger input
+    Parser(std::string_view content, Document& document, int firstLine = 1, int firstCol = 1);
+
+    Document& parseDocument();
+    size_t parseBlocks(bool final);
+    // How many tokens the blocks parsed so far took up
+    size_t tokensUsed() const { return index; }
+    uint32_t parseNode();
+    uint32_t parseHeader();
+    uint32_t parseParagraph();
+    uint32_t parseCodeBlock();
+    uint32_t parseImage();
+    void parseFormattedText(uint32_t parent);
+    uint32_t parseCode();
+    uint32_t parseLink();
     
 private:
+    // An emphasis that hasn't been closed yet, or at the bottom of the
+    // stack the block being filled in
+    struct Opener {
+        uint32_t node;
+        uint32_t last;
+        const Token* token;
+        std::chrono::steady_clock::time_point begin;
+    };
+
     Token* pop();
     Token* peek();
-    Token* accept(std::string data);
-    void expect(std::string data);
+    bool atEnd();
+    Token* accept(TokenKind kind);
+    void expect(TokenKind kind);
+    std::string_view takeUntil(TokenKind sentinel);
+
+    void collectReferences();
+    size_t labelEnd(size_t i);
+    bool definitionAt(size_t i, std::string_view& label, std::string_view& url);
+    uint32_t parseReference(NodeKind kind, const Token& open, std::string_view text);
+    void addAnchor(uint32_t header);
+
+    void parseInline(uint32_t block);
+    void delimiter(const Token& token, NodeKind kind);
+    void appendChild(uint32_t child);
+    void unmatched();
+    void overLimit(const Token& at, const std::string& limit);
+    void traceInline(const char* name, const Token& first, std::chrono::steady_clock::time_point begin);
+
+    uint32_t addNode(NodeKind kind, std::string_view text = {}, std::string_view url = {});
+    Span span(std::string_view text);
 
-    std::vector<Token*> tokens;
-    int index;
+    Document& document;
+    std::vector<Token>& tokens;
+    std::vector<Node>& nodes;
+    size_t index;
+    bool final = true;
+    bool sawEnd = false;
+    // Set once a cap in Limits is hit while parsing; parsing stops where it is
+    bool limited = false;
+    // Set if lexing stopped at a cap before the end of the input
+    bool cut = false;
+    // The block plus at most one open italic and one open bold
+    Opener openers[3];
+    size_t openCount = 0;
+    size_t maxNesting;
+    size_t maxNodes;
+    // When tracing, inline parsing is traced in one block out of every
+    // inlineSampleRate, to keep the trace small and the parser fast
+    static const size_t inlineSampleRate = 64;
+    bool tracing;
+    bool sampling = false;
+    size_t blocksSeen = 0;
 };
\ No newline at end of file
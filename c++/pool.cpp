@@ -0,0 +1,105 @@
+#include <algorithm>
+#include "pool.hpp"
+#include "trace.hpp"
+
+// The pool and worker index of the current thread, if it is a worker
+static thread_local ThreadPool* currentPool = nullptr;
+static thread_local unsigned currentWorker = 0;
+
+ThreadPool::ThreadPool(unsigned threads) : queued(0) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        queues.emplace_back(new Queue());
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        workers.emplace_back(&ThreadPool::run, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(Task task) {
+    unsigned target;
+    if (currentPool == this) {
+        target = currentWorker;
+    } else {
+        std::lock_guard<std::mutex> guard(lock);
+        target = nextQueue;
+        nextQueue = (nextQueue + 1) % queues.size();
+    }
+    // Counted before it's queued so that `queued` never dips below zero; a
+    // worker that wakes up early just looks again
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pending++;
+        queued++;
+    }
+    {
+        std::lock_guard<std::mutex> guard(queues[target]->lock);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this] { return pending == 0; });
+}
+
+// Pops the newest task off the worker's own deque, or else the oldest off
+// someone else's
+bool ThreadPool::take(unsigned worker, Task& task) {
+    for (size_t i = 0; i < queues.size(); i++) {
+        Queue& queue = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::run(unsigned worker) {
+    currentPool = this;
+    currentWorker = worker;
+    Trace::nameThread("worker " + std::to_string(worker));
+    for (;;) {
+        Task task;
+        if (take(worker, task)) {
+            task(worker);
+            std::lock_guard<std::mutex> guard(lock);
+            if (--pending == 0) {
+                idle.notify_all();
+            }
+            continue;
+        }
+        // `queued` only goes up under the lock, so a submit can't slip
+        // between the check and the wait
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [this] { return stopping || queued > 0; });
+        if (stopping) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own task deque. A worker runs
+// its newest task first and, once out of work, steals the oldest task of
+// another worker: a task that fans out keeps its subtasks warm in its own
+// cache while idle workers still take some off its hands.
+class ThreadPool {
+public:
+    // Tasks are told which worker runs them, so they can use per-worker state
+    typedef std::function<void(unsigned worker)> Task;
+
+    // 0 threads means one per core
+    ThreadPool(unsigned threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return unsigned(workers.size()); }
+    // Queues a task. Called from a task, it goes on that worker's own deque.
+    void submit(Task task);
+    // Blocks until every task, including those submitted by tasks, has run
+    void wait();
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    void run(unsigned worker);
+    bool take(unsigned worker, Task& task);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::atomic<size_t> queued;
+    size_t pending = 0;
+    unsigned nextQueue = 0;
+    bool stopping = false;
+};
@@ -0,0 +1,266 @@
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include "scan.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+namespace {
+
+struct StopTable {
+    bool stop[256];
+    // Indexed by [attribute][c]
+    bool escape[2][256];
+
+    StopTable() {
+        memset(stop, 0, sizeof(stop));
+        for (char c : {'_', '*', '`', '#', '[', ']', '(', ')', '!', '\n'}) {
+            stop[static_cast<unsigned char>(c)] = true;
+        }
+        memset(escape, 0, sizeof(escape));
+        for (char c : {'<', '>', '&'}) {
+            escape[0][static_cast<unsigned char>(c)] = true;
+            escape[1][static_cast<unsigned char>(c)] = true;
+        }
+        escape[1][static_cast<unsigned char>('"')] = true;
+    }
+};
+
+const StopTable table;
+
+const char* findSpecialScalar(const char* p, const char* end) {
+    while (p < end && !table.stop[static_cast<unsigned char>(*p)]) {
+        p++;
+    }
+    return p;
+}
+
+const char* findEscapeScalar(const char* p, const char* end, bool attribute) {
+    const bool* escape = table.escape[attribute];
+    while (p < end && !escape[static_cast<unsigned char>(*p)]) {
+        p++;
+    }
+    return p;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+const char* findSpecialSse2(const char* p, const char* end) {
+    const __m128i underscore = _mm_set1_epi8('_');
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i backtick = _mm_set1_epi8('`');
+    const __m128i hash = _mm_set1_epi8('#');
+    const __m128i lbracket = _mm_set1_epi8('[');
+    const __m128i rbracket = _mm_set1_epi8(']');
+    const __m128i lparen = _mm_set1_epi8('(');
+    const __m128i rparen = _mm_set1_epi8(')');
+    const __m128i bang = _mm_set1_epi8('!');
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, underscore), _mm_cmpeq_epi8(v, star)),
+                         _mm_or_si128(_mm_cmpeq_epi8(v, backtick), _mm_cmpeq_epi8(v, hash))),
+            _mm_or_si128(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lbracket), _mm_cmpeq_epi8(v, rbracket)),
+                                      _mm_or_si128(_mm_cmpeq_epi8(v, lparen), _mm_cmpeq_epi8(v, rparen))),
+                         _mm_or_si128(_mm_cmpeq_epi8(v, bang), _mm_cmpeq_epi8(v, newline))));
+        unsigned mask = _mm_movemask_epi8(hit);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return findSpecialScalar(p, end);
+}
+
+// The escape kernels look for `"` only in attributes; in text the fourth
+// comparison repeats `<` instead of branching
+__attribute__((target("sse2")))
+const char* findEscapeSse2(const char* p, const char* end, bool attribute) {
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i quote = _mm_set1_epi8(attribute ? '"' : '<');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, quote)));
+        unsigned mask = _mm_movemask_epi8(hit);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return findEscapeScalar(p, end, attribute);
+}
+
+__attribute__((target("avx2")))
+const char* findSpecialAvx2(const char* p, const char* end) {
+    const __m256i underscore = _mm256_set1_epi8('_');
+    const __m256i star = _mm256_set1_epi8('*');
+    const __m256i backtick = _mm256_set1_epi8('`');
+    const __m256i hash = _mm256_set1_epi8('#');
+    const __m256i lbracket = _mm256_set1_epi8('[');
+    const __m256i rbracket = _mm256_set1_epi8(']');
+    const __m256i lparen = _mm256_set1_epi8('(');
+    const __m256i rparen = _mm256_set1_epi8(')');
+    const __m256i bang = _mm256_set1_epi8('!');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i hit = _mm256_or_si256(
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, underscore), _mm256_cmpeq_epi8(v, star)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v, backtick), _mm256_cmpeq_epi8(v, hash))),
+            _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, lbracket), _mm256_cmpeq_epi8(v, rbracket)),
+                                            _mm256_or_si256(_mm256_cmpeq_epi8(v, lparen), _mm256_cmpeq_epi8(v, rparen))),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v, bang), _mm256_cmpeq_epi8(v, newline))));
+        unsigned mask = _mm256_movemask_epi8(hit);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return findSpecialSse2(p, end);
+}
+
+__attribute__((target("avx2")))
+const char* findEscapeAvx2(const char* p, const char* end, bool attribute) {
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i gt = _mm256_set1_epi8('>');
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i quote = _mm256_set1_epi8(attribute ? '"' : '<');
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, lt), _mm256_cmpeq_epi8(v, gt)),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(v, amp), _mm256_cmpeq_epi8(v, quote)));
+        unsigned mask = _mm256_movemask_epi8(hit);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    // Staying in VEX encoding for the tail; dropping into the SSE kernel
+    // costs a state transition that outweighs short inputs
+    if (end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(lt)), _mm_cmpeq_epi8(v, _mm256_castsi256_si128(gt))),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(amp)), _mm_cmpeq_epi8(v, _mm256_castsi256_si128(quote))));
+        unsigned mask = _mm_movemask_epi8(hit);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return findEscapeScalar(p, end, attribute);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+const char* findSpecialAvx512(const char* p, const char* end) {
+    const __m512i underscore = _mm512_set1_epi8('_');
+    const __m512i star = _mm512_set1_epi8('*');
+    const __m512i backtick = _mm512_set1_epi8('`');
+    const __m512i hash = _mm512_set1_epi8('#');
+    const __m512i lbracket = _mm512_set1_epi8('[');
+    const __m512i rbracket = _mm512_set1_epi8(']');
+    const __m512i lparen = _mm512_set1_epi8('(');
+    const __m512i rparen = _mm512_set1_epi8(')');
+    const __m512i bang = _mm512_set1_epi8('!');
+    const __m512i newline = _mm512_set1_epi8('\n');
+    while (end - p >= 64) {
+        __m512i v = _mm512_loadu_si512(p);
+        __mmask64 mask = _mm512_cmpeq_epi8_mask(v, underscore) | _mm512_cmpeq_epi8_mask(v, star) |
+                         _mm512_cmpeq_epi8_mask(v, backtick) | _mm512_cmpeq_epi8_mask(v, hash) |
+                         _mm512_cmpeq_epi8_mask(v, lbracket) | _mm512_cmpeq_epi8_mask(v, rbracket) |
+                         _mm512_cmpeq_epi8_mask(v, lparen) | _mm512_cmpeq_epi8_mask(v, rparen) |
+                         _mm512_cmpeq_epi8_mask(v, bang) | _mm512_cmpeq_epi8_mask(v, newline);
+        if (mask) {
+            return p + __builtin_ctzll(mask);
+        }
+        p += 64;
+    }
+    return findSpecialAvx2(p, end);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+const char* findEscapeAvx512(const char* p, const char* end, bool attribute) {
+    const __m512i lt = _mm512_set1_epi8('<');
+    const __m512i gt = _mm512_set1_epi8('>');
+    const __m512i amp = _mm512_set1_epi8('&');
+    const __m512i quote = _mm512_set1_epi8(attribute ? '"' : '<');
+    while (p < end) {
+        // The tail is a masked load, which can't fault past the end
+        size_t left = end - p;
+        __mmask64 live = left >= 64 ? ~__mmask64(0) : (__mmask64(1) << left) - 1;
+        __m512i v = _mm512_maskz_loadu_epi8(live, p);
+        __mmask64 mask = (_mm512_cmpeq_epi8_mask(v, lt) | _mm512_cmpeq_epi8_mask(v, gt) |
+                          _mm512_cmpeq_epi8_mask(v, amp) | _mm512_cmpeq_epi8_mask(v, quote)) & live;
+        if (mask) {
+            return p + __builtin_ctzll(mask);
+        }
+        p += left >= 64 ? 64 : left;
+    }
+    return end;
+}
+
+#endif
+
+struct Kernel {
+    const char* name;
+    const char* (*findSpecial)(const char*, const char*);
+    const char* (*findEscape)(const char*, const char*, bool);
+};
+
+Kernel selectKernel() {
+    const char* forced = getenv("CONVERTER_SCAN");
+    Kernel scalar = {"scalar", findSpecialScalar, findEscapeScalar};
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    Kernel kernels[] = {
+        {"avx512", findSpecialAvx512, findEscapeAvx512},
+        {"avx2", findSpecialAvx2, findEscapeAvx2},
+        {"sse2", findSpecialSse2, findEscapeSse2},
+    };
+    bool supported[] = {
+        __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2"),
+        __builtin_cpu_supports("avx2") != 0,
+        __builtin_cpu_supports("sse2") != 0,
+    };
+    for (int i = 0; i < 3; i++) {
+        if (forced && strcmp(forced, kernels[i].name) != 0) {
+            continue;
+        }
+        if (supported[i]) {
+            return kernels[i];
+        }
+    }
+#endif
+    (void)forced;
+    return scalar;
+}
+
+const Kernel& kernel() {
+    static const Kernel selected = selectKernel();
+    return selected;
+}
+
+}
+
+const char* findSpecial(const char* p, const char* end) {
+    return kernel().findSpecial(p, end);
+}
+
+const char* findEscape(const char* p, const char* end, bool attribute) {
+    // Most text runs are a word or two, too short for a vector to pay off
+    if (end - p < 16) {
+        return findEscapeScalar(p, end, attribute);
+    }
+    return kernel().findEscape(p, end, attribute);
+}
+
+const char* scanKernel() {
+    return kernel().name;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstddef>
+
+// Byte scanning kernels used by the lexer and the HTML writer. The widest
+// kernel the CPU supports is picked on first use; setting
+// CONVERTER_SCAN=scalar|sse2|avx2|avx512 in the environment forces a specific
+// one (unsupported choices fall back to scalar).
+
+// Returns a pointer to the first special character (see isSpecialChar) or
+// newline in [p, end), or end if there is none.
+const char* findSpecial(const char* p, const char* end);
+
+// Returns a pointer to the first character in [p, end) that HTML needs
+// escaped: one of `<>&`, and `"` as well if `attribute` is set. Returns end
+// if there is none.
+const char* findEscape(const char* p, const char* end, bool attribute);
+
+// Name of the kernel findSpecial and findEscape dispatch to
+const char* scanKernel();
@@ -0,0 +1,162 @@
+#include <cerrno>
+#include <fcntl.h>
+#include "sink.hpp"
+
+#ifdef _WIN32
+#include <io.h>
+
+static int openFd(const char* path) { return _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644); }
+static long writeFd(int fd, const char* data, size_t length) { return _write(fd, data, unsigned(length)); }
+static void closeFd(int fd) { _close(fd); }
+#else
+#include <unistd.h>
+
+static int openFd(const char* path) { return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644); }
+static long writeFd(int fd, const char* data, size_t length) { return write(fd, data, length); }
+static void closeFd(int fd) { close(fd); }
+#endif
+
+FdSink::~FdSink() {
+    close();
+}
+
+bool FdSink::open(const std::string& path) {
+    close();
+    fd = openFd(path.c_str());
+    owned = fd >= 0;
+    return owned;
+}
+
+void FdSink::attach(int fd) {
+    close();
+    this->fd = fd;
+}
+
+void FdSink::close() {
+    if (owned) {
+        closeFd(fd);
+        fd = -1;
+        owned = false;
+    }
+}
+
+bool FdSink::write(const char* data, size_t length) {
+    while (length > 0) {
+        long n = writeFd(fd, data, length);
+        // A signal handler installed without SA_RESTART (see daemon.cpp)
+        // interrupts a write without anything having gone wrong
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool StringSink::write(const char* data, size_t length) {
+    out.append(data, length);
+    return true;
+}
+
+bool CallbackSink::write(const char* data, size_t length) {
+    return callback(data, length);
+}
+
+OutputBuffer::OutputBuffer(Sink& sink, size_t capacity) : sink(&sink) {
+    data = new char[capacity];
+    cursor = data;
+    limit = data + capacity;
+}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+    delete[] data;
+}
+
+void OutputBuffer::appendInt(int value) {
+    char digits[16];
+    char* end = digits + sizeof(digits);
+    char* p = end;
+    unsigned magnitude = value < 0 ? 0u - unsigned(value) : unsigned(value);
+    do {
+        *--p = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) {
+        *--p = '-';
+    }
+    append(p, end - p);
+}
+
+bool OutputBuffer::flush() {
+    if (cursor != data) {
+        if (!error && !sink->write(data, cursor - data)) {
+            error = true;
+        }
+        total += cursor - data;
+        cursor = data;
+    }
+    return !error;
+}
+
+void OutputBuffer::reset() {
+    cursor = data;
+    total = 0;
+    error = false;
+}
+
+void OutputBuffer::reset(Sink& sink) {
+    reset();
+    this->sink = &sink;
+}
+
+// Slow path of append(): top up and flush the buffer, then either buffer the
+// rest or pass it straight through if it wouldn't fit anyway
+void OutputBuffer::spill(const char* bytes, size_t length) {
+    size_t room = limit - cursor;
+    memcpy(cursor, bytes, room);
+    cursor += room;
+    bytes += room;
+    length -= room;
+    flush();
+    if (length >= size_t(limit - data)) {
+        if (!error && !sink->write(bytes, length)) {
+            error = true;
+        }
+        total += length;
+    } else {
+        memcpy(cursor, bytes, length);
+        cursor += length;
+    }
+}
+
+// Appends `text` as a JSON string. Clean runs are copied whole.
+void appendJSONString(OutputBuffer& out, std::string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    out.append('"');
+    size_t clean = 0;
+    for (size_t i = 0; i < text.length(); i++) {
+        unsigned char c = text[i];
+        if (c != '"' && c != '\\' && c >= 0x20) {
+            continue;
+        }
+        out.append(text.data() + clean, i - clean);
+        clean = i + 1;
+        if (c == '"' || c == '\\') {
+            out.append('\\');
+            out.append(char(c));
+        } else if (c == '\n') {
+            out.append("\\n");
+        } else {
+            out.append("\\u00");
+            out.append(hex[c >> 4]);
+            out.append(hex[c & 15]);
+        }
+    }
+    out.append(text.data() + clean, text.length() - clean);
+    out.append('"');
+}
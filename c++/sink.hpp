@@ -0,0 +1,115 @@
+#pragma once
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// Destination for rendered output. Renderers never call a sink directly;
+// they append to an OutputBuffer, which hands the sink large chunks.
+class Sink {
+public:
+    virtual ~Sink() {}
+    virtual bool write(const char* data, size_t length) = 0;
+};
+
+// Writes to a file descriptor, optionally one it opened (and closes) itself
+class FdSink: public Sink {
+public:
+    FdSink(int fd = -1) {
+        this->fd = fd;
+    }
+    ~FdSink();
+    FdSink(const FdSink&) = delete;
+    FdSink& operator=(const FdSink&) = delete;
+
+    // Creates or truncates `path` and writes to it
+    bool open(const std::string& path);
+    // Writes to an already open descriptor, which is left open
+    void attach(int fd);
+    // Closes the descriptor if it was opened by open()
+    void close();
+    virtual bool write(const char* data, size_t length);
+
+private:
+    int fd;
+    bool owned = false;
+};
+
+// Throws output away
+class NullSink: public Sink {
+public:
+    virtual bool write(const char*, size_t) { return true; }
+};
+
+class StringSink: public Sink {
+public:
+    StringSink(std::string& out) : out(out) {}
+    virtual bool write(const char* data, size_t length);
+
+private:
+    std::string& out;
+};
+
+class CallbackSink: public Sink {
+public:
+    CallbackSink(std::function<bool(const char*, size_t)> callback) {
+        this->callback = callback;
+    }
+    virtual bool write(const char* data, size_t length);
+
+private:
+    std::function<bool(const char*, size_t)> callback;
+};
+
+// Fixed-size staging buffer in front of a sink. Appends are a bounds check
+// and a memcpy; the sink only sees full buffers, oversized appends, and
+// whatever is left at flush().
+class OutputBuffer {
+public:
+    OutputBuffer(Sink& sink, size_t capacity = 64 * 1024);
+    ~OutputBuffer();
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void append(const char* data, size_t length) {
+        if (length <= size_t(limit - cursor)) {
+            memcpy(cursor, data, length);
+            cursor += length;
+        } else {
+            spill(data, length);
+        }
+    }
+    void append(std::string_view text) {
+        append(text.data(), text.length());
+    }
+    void append(char c) {
+        if (cursor == limit) {
+            flush();
+        }
+        *cursor++ = c;
+    }
+    void appendInt(int value);
+
+    bool flush();
+    bool failed() const { return error; }
+    // Drops anything buffered and clears failed() and written(), so the
+    // buffer can be reused for another output
+    void reset();
+    // The same, writing to `sink` from now on
+    void reset(Sink& sink);
+    // Total bytes appended so far, flushed or not
+    size_t written() const { return total + (cursor - data); }
+
+private:
+    void spill(const char* data, size_t length);
+
+    Sink* sink;
+    char* data;
+    char* cursor;
+    char* limit;
+    size_t total = 0;
+    bool error = false;
+};
+
+// Appends `text` as a quoted JSON string
+void appendJSONString(OutputBuffer& out, std::string_view text);
@@ -0,0 +1,215 @@
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include "stats.hpp"
+#include "trace.hpp"
+
+// Counted per thread, so that a worker can tell its own allocations apart
+// from everyone else's without any synchronisation
+static thread_local size_t threadAllocations = 0;
+static thread_local size_t threadAllocatedBytes = 0;
+
+void* operator new(size_t size) {
+    threadAllocations++;
+    threadAllocatedBytes += size;
+    if (void* memory = malloc(size > 0 ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    free(memory);
+}
+
+HeapUsage heapUsage() {
+    return HeapUsage{threadAllocations, threadAllocatedBytes};
+}
+
+const char* phaseName(Phase phase) {
+    switch (phase) {
+    case Phase::Read: return "read";
+    case Phase::Tokenize: return "tokenize";
+    case Phase::Parse: return "parse";
+    case Phase::Render: return "render";
+    case Phase::Write: return "write";
+    case Phase::None: return "none";
+    }
+    return "?";
+}
+
+Stats::Stats() {
+    heapAtStart = heapUsage();
+}
+
+Phase Stats::enter(Phase phase) {
+    if (hardware && !hardwareCounters) {
+        hardwareCounters = &HardwareCounters::thread();
+        countingHardware = hardwareCounters->available();
+        hardwareError = hardwareCounters->error();
+        for (size_t i = 0; i < counterCount; i++) {
+            countable[i] = countingHardware && hardwareCounters->counts(Counter(i));
+        }
+    }
+    uint64_t events[counterCount];
+    bool counted = countingHardware && hardwareCounters->read(events);
+    auto now = std::chrono::steady_clock::now();
+    if (running != Phase::None) {
+        elapsed[size_t(running)] += std::chrono::duration<double>(now - since).count();
+        if (Trace::enabled()) {
+            Trace::span(phaseName(running), "phase", since, now);
+        }
+    }
+    if (counted) {
+        for (size_t i = 0; i < counterCount; i++) {
+            if (running != Phase::None) {
+                phaseEvents[size_t(running)][i] += events[i] - lastEvents[i];
+            }
+            lastEvents[i] = events[i];
+        }
+    }
+    Phase previous = running;
+    running = phase;
+    since = now;
+    if (phase == Phase::None) {
+        hardwareCounters = nullptr;
+        HeapUsage heap = heapUsage();
+        allocations = heap.allocations - heapAtStart.allocations;
+        allocatedBytes = heap.bytes - heapAtStart.bytes;
+    }
+    return previous;
+}
+
+namespace {
+
+struct NodeCounter {
+    Stats& stats;
+    size_t depth;
+
+    void enter(const Node& node) {
+        stats.nodes[size_t(node.kind)]++;
+        if (node.kind == NodeKind::Italic || node.kind == NodeKind::Bold) {
+            depth++;
+            if (depth > stats.maxInlineDepth) {
+                stats.maxInlineDepth = depth;
+            }
+        }
+    }
+
+    void leave(const Node& node) {
+        if (node.kind == NodeKind::Italic || node.kind == NodeKind::Bold) {
+            depth--;
+        }
+    }
+};
+
+}
+
+void Stats::count(const Tree& tree) {
+    NodeCounter counter{*this, 0};
+    for (size_t i = 0; i < tree.blockCount; i++) {
+        walk(tree, tree.blocks[i], counter);
+    }
+}
+
+bool TimedSink::write(const char* data, size_t length) {
+    Phase previous = stats->enter(Phase::Write);
+    bool ok = sink.write(data, length);
+    stats->enter(previous);
+    return ok;
+}
+
+// One phase's events, with IPC and each count per KB of input
+static void writeEvents(std::ostream& out, const Stats& stats, const uint64_t events[counterCount]) {
+    out << "{";
+    const char* separator = "";
+    for (size_t i = 0; i < counterCount; i++) {
+        if (stats.counted(Counter(i))) {
+            out << separator << '"' << counterName(Counter(i)) << "\": " << events[i];
+            separator = ", ";
+        }
+    }
+    size_t cycles = size_t(Counter::Cycles);
+    size_t instructions = size_t(Counter::Instructions);
+    if (stats.counted(Counter::Cycles) && stats.counted(Counter::Instructions) && events[cycles] > 0) {
+        out << separator << "\"ipc\": " << std::fixed << std::setprecision(3) << double(events[instructions]) / events[cycles];
+    }
+    if (stats.inputBytes > 0) {
+        out << separator << "\"per_kb\": {";
+        separator = "";
+        for (size_t i = 0; i < counterCount; i++) {
+            if (stats.counted(Counter(i))) {
+                out << separator << '"' << counterName(Counter(i)) << "\": "
+                    << std::fixed << std::setprecision(1) << events[i] * 1024.0 / stats.inputBytes;
+                separator = ", ";
+            }
+        }
+        out << "}";
+    }
+    out << "}";
+}
+
+static void writeHardware(std::ostream& out, const Stats& stats) {
+    if (!stats.hardwareError.empty()) {
+        out << "{\"error\": ";
+        writeJSONString(out, stats.hardwareError);
+        out << "}";
+        return;
+    }
+    uint64_t total[counterCount] = {};
+    out << "{";
+    for (size_t phase = 0; phase < phaseCount; phase++) {
+        uint64_t events[counterCount];
+        for (size_t i = 0; i < counterCount; i++) {
+            events[i] = stats.events(Phase(phase), Counter(i));
+            total[i] += events[i];
+        }
+        out << '"' << phaseName(Phase(phase)) << "\": ";
+        writeEvents(out, stats, events);
+        out << ", ";
+    }
+    out << "\"total\": ";
+    writeEvents(out, stats, total);
+    out << "}";
+}
+
+void writeStatsJSON(std::ostream& out, const std::string& input, const Stats& stats) {
+    out << "{\"input\": ";
+    writeJSONString(out, input);
+    out << ", \"input_bytes\": " << stats.inputBytes
+        << ", \"output_bytes\": " << stats.outputBytes
+        << ", \"tokens\": " << stats.tokens
+        << ", \"nodes\": {";
+    for (size_t i = 0; i < nodeKindCount; i++) {
+        out << (i > 0 ? ", " : "") << '"' << nodeKindName(NodeKind(i)) << "\": " << stats.nodes[i];
+    }
+    out << "}, \"max_inline_depth\": " << stats.maxInlineDepth
+        << ", \"heap\": {\"allocations\": " << stats.allocations << ", \"bytes\": " << stats.allocatedBytes << "}"
+        << ", \"phase_ms\": {";
+    for (size_t i = 0; i < phaseCount; i++) {
+        out << (i > 0 ? ", " : "") << '"' << phaseName(Phase(i)) << "\": "
+            << std::fixed << std::setprecision(3) << stats.seconds(Phase(i)) * 1e3;
+    }
+    out << "}";
+    if (stats.hardware) {
+        out << ", \"hardware\": ";
+        writeHardware(out, stats);
+    }
+    out << "}";
+}
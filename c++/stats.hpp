@@ -0,0 +1,95 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include "counters.hpp"
+#include "node.hpp"
+#include "sink.hpp"
+
+enum class Phase {
+    Read,
+    Tokenize,
+    Parse,
+    Render,
+    Write,
+    None,
+};
+
+constexpr size_t phaseCount = size_t(Phase::None);
+const char* phaseName(Phase phase);
+
+// Heap use by the calling thread since it started, as counted by the
+// replacement operator new in stats.cpp
+struct HeapUsage {
+    size_t allocations;
+    size_t bytes;
+};
+
+HeapUsage heapUsage();
+
+// What --stats reports about one conversion. Time is charged to one phase
+// at a time: enter() stops the clock on the running phase and starts it on
+// the next, so phases that interleave (rendering fills a buffer, writing
+// drains it) are still told apart.
+class Stats {
+public:
+    Stats();
+
+    // Starts charging time to `phase` and returns the phase that was running
+    Phase enter(Phase phase);
+    void stop() { enter(Phase::None); }
+    double seconds(Phase phase) const { return elapsed[size_t(phase)]; }
+
+    // Adds the nodes of `tree` to the node counts and inline depth
+    void count(const Tree& tree);
+
+    // Hardware events charged to `phase`, if hardware is set and `counter`
+    // could be counted
+    uint64_t events(Phase phase, Counter counter) const { return phaseEvents[size_t(phase)][size_t(counter)]; }
+    bool counted(Counter counter) const { return countable[size_t(counter)]; }
+
+    // Set before the first enter() to count hardware events per phase as
+    // well, on whichever thread does the conversion
+    bool hardware = false;
+    // Why hardware events weren't counted, if they were asked for
+    std::string hardwareError;
+
+    size_t inputBytes = 0;
+    size_t tokens = 0;
+    size_t nodes[nodeKindCount] = {};
+    size_t maxInlineDepth = 0;
+    size_t outputBytes = 0;
+    // Heap use between construction and the last stop()
+    size_t allocations = 0;
+    size_t allocatedBytes = 0;
+
+private:
+    double elapsed[phaseCount] = {};
+    Phase running = Phase::None;
+    std::chrono::steady_clock::time_point since;
+    HeapUsage heapAtStart;
+    // The running thread's counters, only held while a phase runs: they go
+    // when the thread does, which can be before the stats are reported
+    HardwareCounters* hardwareCounters = nullptr;
+    bool countingHardware = false;
+    bool countable[counterCount] = {};
+    uint64_t lastEvents[counterCount] = {};
+    uint64_t phaseEvents[phaseCount][counterCount] = {};
+};
+
+// Passes writes through to another sink, charging the time to Phase::Write
+class TimedSink: public Sink {
+public:
+    TimedSink(Sink& sink, Stats& stats) : sink(sink), stats(&stats) {}
+    // Charges later writes to `stats` instead
+    void retarget(Stats& stats) { this->stats = &stats; }
+    virtual bool write(const char* data, size_t length);
+
+private:
+    Sink& sink;
+    Stats* stats;
+};
+
+// Writes one conversion's stats as a JSON object
+void writeStatsJSON(std::ostream& out, const std::string& input, const Stats& stats);
@@ -0,0 +1,113 @@
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "node.hpp"
+#include "parser.hpp"
+#include "stream.hpp"
+
+#ifdef _WIN32
+#include <io.h>
+
+static long readFd(int fd, char* data, size_t length) { return _read(fd, data, unsigned(length)); }
+#else
+#include <unistd.h>
+
+static long readFd(int fd, char* data, size_t length) { return read(fd, data, length); }
+#endif
+
+bool convertStream(int fd, OutputBuffer& out, Stats* stats, const Limits& limits) {
+    const size_t chunkSize = 64 * 1024;
+    auto enter = [stats](Phase phase) {
+        if (stats) {
+            stats->enter(phase);
+        }
+    };
+
+    // Each chunk is held to the limits on its own as it's parsed, and the
+    // totals to them here
+    Document document;
+    document.setLimits(limits);
+    std::string buffer;
+    size_t chunk = chunkSize;
+    int line = 1;
+    int col = 1;
+    bool eof = false;
+    size_t inputBytes = 0;
+    size_t tokens = 0;
+    size_t nodes = 0;
+    auto overLimit = [&line, &col](const std::string& limit) {
+        printDiagnostic(std::cerr, Diagnostic{line, col, "", "", 0, limit});
+        return false;
+    };
+    while (!eof) {
+        enter(Phase::Read);
+        size_t old = buffer.size();
+        buffer.resize(old + chunk);
+        long n = readFd(fd, &buffer[old], chunk);
+        if (n < 0) {
+            std::cerr << "error reading input" << std::endl;
+            return false;
+        }
+        buffer.resize(old + n);
+        eof = n == 0;
+        inputBytes += n;
+        if (limits.inputBytes && inputBytes > limits.inputBytes) {
+            return overLimit("input is larger than " + std::to_string(limits.inputBytes) + " bytes");
+        }
+        if (stats) {
+            stats->inputBytes += n;
+        }
+
+        // Only text up to the last newline is sure to lex the same once more arrives
+        size_t complete = buffer.size();
+        if (!eof) {
+            size_t newline = buffer.rfind('\n');
+            complete = newline == std::string::npos ? 0 : newline + 1;
+        }
+
+        size_t consumed = 0;
+        if (complete > 0) {
+            enter(Phase::Tokenize);
+            Parser parser(std::string_view(buffer).substr(0, complete), document, line, col);
+            enter(Phase::Parse);
+            consumed = parser.parseBlocks(eof);
+            if (!document.diagnostics().empty()) {
+                printDiagnostic(std::cerr, document.diagnostics().front());
+                return false;
+            }
+            tokens += parser.tokensUsed();
+            nodes += document.tree().nodeCount;
+            if (limits.tokens && tokens > limits.tokens) {
+                return overLimit("more than " + std::to_string(limits.tokens) + " tokens");
+            }
+            if (limits.nodes && nodes > limits.nodes) {
+                return overLimit("more than " + std::to_string(limits.nodes) + " nodes");
+            }
+            enter(Phase::Render);
+            writeHTML(out, document.tree());
+            if (!out.flush()) {
+                return false;
+            }
+            if (stats) {
+                stats->tokens += parser.tokensUsed();
+                stats->count(document.tree());
+            }
+        }
+
+        if (consumed == 0 && !eof) {
+            // A block is still open. Read at least as much again as is
+            // buffered before re-lexing it, so a huge block costs linear
+            // time overall rather than quadratic
+            chunk = buffer.size() > chunkSize ? buffer.size() : chunkSize;
+        } else {
+            advancePosition(line, col, std::string_view(buffer).substr(0, consumed));
+            buffer.erase(0, consumed);
+            chunk = chunkSize;
+        }
+    }
+    if (stats) {
+        stats->stop();
+        stats->outputBytes = out.written();
+    }
+    return true;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "parser.hpp"
+#include "sink.hpp"
+#include "stats.hpp"
+
+// Converts everything readable from `fd` to HTML on `out`, one top-level
+// block at a time: each block is written (and `out` flushed) as soon as the
+// input that completes it has arrived. Memory use is bounded by the largest
+// block rather than the whole input. Returns false on a read or write error.
+// If `stats` is given, phase times and counters are added up into it.
+// `limits` cap the input as a whole; going over one is reported like a
+// parse error, once the blocks before it have been written. Blocks are gone
+// by the time later input arrives, so a reference link only finds a
+// definition that came in with the same read; otherwise it stays as text.
+bool convertStream(int fd, OutputBuffer& out, Stats* stats = nullptr, const Limits& limits = Limits());
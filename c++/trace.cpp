@@ -0,0 +1,118 @@
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "sink.hpp"
+#include "trace.hpp"
+
+std::atomic<bool> Trace::on(false);
+
+namespace {
+
+struct Event {
+    std::string name;
+    const char* category;
+    Trace::Time begin;
+    Trace::Time end;
+    std::string args;
+};
+
+// One thread's lane. Lanes outlive their threads so that a pool can be
+// torn down before the trace is written.
+struct Lane {
+    unsigned id;
+    std::string name;
+    std::vector<Event> events;
+};
+
+std::mutex lanesLock;
+std::vector<std::unique_ptr<Lane>> lanes;
+Trace::Time origin;
+
+Lane& currentLane() {
+    static thread_local Lane* lane = nullptr;
+    if (!lane) {
+        std::lock_guard<std::mutex> guard(lanesLock);
+        lanes.emplace_back(new Lane());
+        lane = lanes.back().get();
+        lane->id = unsigned(lanes.size());
+        lane->name = "thread " + std::to_string(lane->id);
+    }
+    return *lane;
+}
+
+double microseconds(Trace::Time time) {
+    return std::chrono::duration<double, std::micro>(time - origin).count();
+}
+
+}
+
+void Trace::start() {
+    origin = std::chrono::steady_clock::now();
+    on = true;
+}
+
+void Trace::span(std::string name, const char* category, Time begin, Time end, std::string args) {
+    if (!enabled()) {
+        return;
+    }
+    currentLane().events.push_back(Event{std::move(name), category, begin, end, std::move(args)});
+}
+
+void Trace::nameThread(std::string name) {
+    if (!enabled()) {
+        return;
+    }
+    currentLane().name = std::move(name);
+}
+
+bool Trace::write(const std::string& path) {
+    std::ofstream out(path);
+    std::lock_guard<std::mutex> guard(lanesLock);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    const char* separator = "";
+    for (const std::unique_ptr<Lane>& lane : lanes) {
+        out << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << lane->id << ", \"args\": {\"name\": ";
+        writeJSONString(out, lane->name);
+        out << "}}";
+        separator = ",\n";
+        for (const Event& event : lane->events) {
+            out << separator << "{\"name\": ";
+            writeJSONString(out, event.name);
+            out << ", \"cat\": \"" << event.category << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << lane->id
+                << std::fixed << std::setprecision(3) << ", \"ts\": " << microseconds(event.begin)
+                << ", \"dur\": " << microseconds(event.end) - microseconds(event.begin);
+            if (!event.args.empty()) {
+                out << ", \"args\": {" << event.args << "}";
+            }
+            out << "}";
+        }
+    }
+    out << "\n]}" << std::endl;
+    return bool(out);
+}
+
+TraceSpan::TraceSpan(const char* category, std::string_view name)
+    : category(category), active(Trace::enabled()) {
+    if (active) {
+        this->name = name;
+        begin = std::chrono::steady_clock::now();
+    }
+}
+
+TraceSpan::~TraceSpan() {
+    if (active) {
+        Trace::span(std::move(name), category, begin, std::chrono::steady_clock::now(), std::move(args));
+    }
+}
+
+// The same escaping as the JSON renderer, via a small buffer
+void writeJSONString(std::ostream& out, std::string_view text) {
+    std::string json;
+    StringSink sink(json);
+    OutputBuffer buffer(sink, 256);
+    appendJSONString(buffer, text);
+    buffer.flush();
+    out << json;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Records spans for a Chrome trace-event file (chrome://tracing, Perfetto).
+// Each thread records into its own buffer and shows up as its own lane;
+// nothing is recorded until start() is called, and until then every call
+// here costs one relaxed load.
+class Trace {
+public:
+    typedef std::chrono::steady_clock::time_point Time;
+
+    static void start();
+    static bool enabled() { return on.load(std::memory_order_relaxed); }
+
+    // Records a complete span on the calling thread. `args`, if given, is
+    // the inside of a JSON object, like "\"line\": 3".
+    static void span(std::string name, const char* category, Time begin, Time end, std::string args = "");
+    // Labels the calling thread's lane
+    static void nameThread(std::string name);
+
+    // Writes everything recorded so far. Call once the threads that
+    // recorded have finished.
+    static bool write(const std::string& path);
+
+private:
+    static std::atomic<bool> on;
+};
+
+// Records a span from construction to destruction, if tracing. The name is
+// only copied if it will be recorded; args that take work to build are set
+// afterwards, behind a check of recording().
+class TraceSpan {
+public:
+    TraceSpan(const char* category, std::string_view name);
+    ~TraceSpan();
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    bool recording() const { return active; }
+    // The inside of a JSON object, as for Trace::span
+    void setArgs(std::string args) { this->args = std::move(args); }
+
+private:
+    const char* category;
+    std::string name;
+    std::string args;
+    bool active;
+    Trace::Time begin;
+};
+
+// Writes `text` as a quoted JSON string
+void writeJSONString(std::ostream& out, std::string_view text);
@@ -0,0 +1,132 @@
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include "incremental.hpp"
+#include "sink.hpp"
+#include "watch.hpp"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read rather than mapped: an editor that saves by rewriting the file in
+// place can shrink it under a mapping, and touching the pages it lost would
+// kill the watcher with SIGBUS
+static bool readText(const std::string& path, std::string& text) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    text.clear();
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        text.reserve(st.st_size);
+    }
+    // The size is only a hint, as the file may still be changing
+    char chunk[64 * 1024];
+    for (;;) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            close(fd);
+            return n == 0;
+        }
+        text.append(chunk, n);
+    }
+}
+#endif
+
+// Writes beside the output and renames over it, so that whatever is
+// previewing it never sees half a file
+static bool writeText(const std::string& path, const std::string& html) {
+    if (path == "-") {
+        FdSink out(1);
+        return out.write(html.data(), html.length());
+    }
+    std::string temp = path + ".tmp";
+    FdSink file;
+    if (!file.open(temp)) {
+        return false;
+    }
+    bool ok = file.write(html.data(), html.length());
+    file.close();
+    if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+int watchFile(const std::string& input, const std::string& output) {
+#ifdef __linux__
+    // Editors often save by writing a new file and renaming it over the
+    // old one, so watch the directory for the name rather than the file
+    std::filesystem::path path(input);
+    std::string directory = path.has_parent_path() ? path.parent_path().string() : ".";
+    std::string name = path.filename().string();
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        std::cerr << "error watching " << input << std::endl;
+        return 1;
+    }
+
+    IncrementalConverter converter;
+    std::string written;
+    bool first = true;
+    auto convert = [&]() {
+        std::string text;
+        if (!readText(input, text)) {
+            std::cerr << "error reading input file " << input << std::endl;
+            return;
+        }
+        if (!converter.update(std::move(text))) {
+            printDiagnostic(std::cerr, converter.error());
+            return;
+        }
+        if (!first && converter.html() == written) {
+            return;
+        }
+        if (!writeText(output, converter.html())) {
+            std::cerr << "error writing output file" << std::endl;
+            return;
+        }
+        written = converter.html();
+        first = false;
+    };
+
+    convert();
+    alignas(inotify_event) char events[4096];
+    for (;;) {
+        ssize_t n = read(fd, events, sizeof(events));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            std::cerr << "error watching " << input << std::endl;
+            close(fd);
+            return 1;
+        }
+        bool changed = false;
+        for (char* p = events; p < events + n;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+            if (event->len > 0 && name == event->name) {
+                changed = true;
+            }
+            p += sizeof(inotify_event) + event->len;
+        }
+        if (changed) {
+            convert();
+        }
+    }
+#else
+    (void)input;
+    (void)output;
+    std::cerr << "--watch needs inotify, which this platform doesn't have" << std::endl;
+    return 1;
+#endif
+}
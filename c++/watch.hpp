@@ -0,0 +1,8 @@
+#pragma once
+#include <string>
+
+// Converts `input` to `output`, then again each time the file is saved,
+// until killed. Only the blocks an edit touched are re-parsed, and the
+// output is only rewritten when the HTML comes out different. Returns
+// (non-zero) only if watching can't be set up.
+int watchFile(const std::string& input, const std::string& output);
@@ -0,0 +1,40 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ARENA_BLOCK_SIZE (1 << 20)
+#define ARENA_ALIGN 8
+
+void* Arena_Alloc(Arena* arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    ArenaBlock* block = arena->top;
+    if (!block || block->capacity - block->used < size) 
+    {
+        size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + capacity);
+        if (!block) 
+        {
+            fprintf(stderr, "error allocating memory");
+            exit(1);
+        }
+        block->prev = arena->top;
+        block->used = 0;
+        block->capacity = capacity;
+        arena->top = block;
+    }
+    // The header is a multiple of the alignment, so everything after it is too
+    void* retval = (char*)(block + 1) + block->used;
+    block->used += size;
+    return retval;
+}
+
+void Arena_Free(Arena* arena)
+{
+    while (arena->top) 
+    {
+        ArenaBlock* prev = arena->top->prev;
+        free(arena->top);
+        arena->top = prev;
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// A bump allocator. Memory is handed out from large blocks and only given
+// back all at once, by Arena_Free.
+typedef struct arenaBlock 
+{
+    struct arenaBlock* prev;
+    size_t used;
+    size_t capacity;
+} ArenaBlock;
+
+typedef struct arena 
+{
+    ArenaBlock* top;
+} Arena;
+
+void* Arena_Alloc(Arena* arena, size_t size);
+
+void Arena_Free(Arena* arena);
+
+#endif
@@ -1,4 +1,4 @@
-// To run: gcc converter.c list.c node.c parser.c string.c token.c -o converter.exe && converter.exe ../input.md
+// To run: gcc converter.c arena.c node.c output.c parser.c string.c token.c -o converter.exe && converter.exe ../input.md
 // Pros:
 //  - Fast
 //  - No garbage collector
@@ -23,53 +23,159 @@
 //  - Impossible to debug
 //  - Weakly typed
 
+#include "arena.h"
 #include "node.h"
+#include "output.h"
 #include "parser.h"
 #include "string.h"
+#include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#define O_BINARY 0
+#endif
 
-int main(int argc, char** argv)
+// Reads all of `fd` with as few reads as possible: a regular file's size is
+// known up front, anything else (a pipe, a terminal) is read into a buffer
+// that doubles as it fills. The contents end with a '\0' that isn't
+// counted, since the tokenizer can look one character past the end.
+static bool readAll(int fd, String* contents)
 {
-    if (argc != 2) 
+    struct stat info;
+    bool sized = fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+    if (sized && info.st_size >= 0x7fffffff) 
     {
-        fprintf(stderr, "usage: converter.exe <markdown-filename>\n");
-        system("pause");
-    } 
-    else 
+        return false;
+    }
+    int capacity = sized ? (int)info.st_size + 1 : 1 << 16;
+    char* data = malloc(capacity);
+    int length = 0;
+    while (data) 
     {
-        // Open input file
-        FILE* input = fopen(argv[1], "r");
-        if (!input) 
+        // A regular file is done once its size has been read
+        if (length == capacity - 1 && sized) 
         {
-            fprintf(stderr, "error opening input file");
-            exit(1);
+            break;
         }
-
-        // Read into a string
-        String contents = String_New();
-        int nextChar;
-        while ((nextChar = fgetc(input)) != EOF) 
+        if (length == capacity - 1) 
         {
-            String_Append(&contents, nextChar);
+            char* bigger = capacity > 0x3fffffff ? NULL : realloc(data, (size_t)capacity * 2);
+            if (!bigger) 
+            {
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = bigger;
+            capacity *= 2;
         }
-        fclose(input);
+        int count = read(fd, data + length, capacity - 1 - length);
+        if (count < 0) 
+        {
+            free(data);
+            data = NULL;
+        } 
+        else if (count == 0) 
+        {
+            break;
+        }
+        length += count;
+    }
+    if (!data) 
+    {
+        return false;
+    }
+    data[length] = '\0';
+    *contents = (String){data, length, capacity};
+    return true;
+}
 
-        // Create parser, parse documents
-        Parser_Init(contents);
-        List* document = Parser_ParseDocument();
+static void usage()
+{
+    fprintf(stderr, "usage: converter.exe [-o <output>] <markdown-filename>\n");
+    fprintf(stderr, "  A filename of - reads stdin. Output goes to output.html, or to stdout when\n");
+    fprintf(stderr, "  reading stdin, unless -o is given (- for stdout).\n");
+}
 
-        // Write out document
-        FILE* output = fopen("output.html", "w");
-        if (!input) 
+int main(int argc, char** argv)
+{
+    const char* inputPath = NULL;
+    const char* outputPath = NULL;
+    for (int i = 1; i < argc; i++) 
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) 
         {
-            fprintf(stderr, "error opening output file");
-            exit(1);
-        }
-        forall (elem, document)
+            outputPath = argv[++i];
+        } 
+        else if (!inputPath && (strcmp(argv[i], "-") == 0 || argv[i][0] != '-')) 
         {
-            Node_WriteHTML(output, elem->data);
+            inputPath = argv[i];
+        } 
+        else 
+        {
+            inputPath = NULL;
+            break;
         }
-        fclose(output);
     }
-}
\ No newline at end of file
+    if (!inputPath) 
+    {
+        usage();
+        system("pause");
+        return 1;
+    }
+    bool fromStdin = strcmp(inputPath, "-") == 0;
+    if (!outputPath) 
+    {
+        outputPath = fromStdin ? "-" : "output.html";
+    }
+
+    // Read the whole input in one go
+    int input = fromStdin ? 0 : open(inputPath, O_RDONLY | O_BINARY);
+    String contents;
+    if (input < 0 || !readAll(input, &contents)) 
+    {
+        fprintf(stderr, "error reading input file %s\n", inputPath);
+        exit(1);
+    }
+    if (!fromStdin) 
+    {
+        close(input);
+    }
+
+    // Create parser, parse documents
+    Arena arena = {0};
+    Parser_Init(contents, &arena);
+    Node* document = Parser_ParseDocument();
+
+    // Write out document
+    bool toStdout = strcmp(outputPath, "-") == 0;
+    FILE* file = toStdout ? stdout : fopen(outputPath, "w");
+    if (!file) 
+    {
+        fprintf(stderr, "error opening output file %s\n", outputPath);
+        exit(1);
+    }
+    // Output does its own buffering
+    setvbuf(file, NULL, _IONBF, 0);
+    static Output output;
+    Output_Init(&output, file);
+    for (Node* node = document; node; node = node->next)
+    {
+        Node_WriteHTML(&output, node);
+    }
+    bool ok = Output_Flush(&output);
+    if ((!toStdout && fclose(file) != 0) || !ok) 
+    {
+        fprintf(stderr, "error writing output file %s\n", outputPath);
+        exit(1);
+    }
+    Arena_Free(&arena);
+    free(contents.data);
+    return 0;
+}
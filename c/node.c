@@ -1,97 +1,101 @@
 #include "node.h"
 #include "string.h"
-#include <stdlib.h>
 
-Node* Node_New(NodeType type, int size, List* children, String text, String url)
+Node* Node_New(Arena* arena, NodeType type, int size, Node* children, String text, String url)
 {
-    Node* retval = malloc(sizeof(Node));
+    Node* retval = Arena_Alloc(arena, sizeof(Node));
     retval->type = type;
     retval->size = size;
     retval->children = children;
+    retval->next = NULL;
     retval->text = text;
     retval->url = url;
     return retval;
 }
 
-void Node_WriteHTML(FILE* out, Node* node)
+void Node_WriteHTML(Output* out, Node* node)
 {
     switch (node->type) 
     {
     case HEADER: 
     {
-        fprintf(out, "<h%d>", node->size);
-        forall(elem, node->children)
+        Output_WriteText(out, "<h");
+        Output_WriteInt(out, node->size);
+        Output_WriteText(out, ">");
+        for (Node* child = node->children; child; child = child->next)
         {
-            Node_WriteHTML(out, elem->data);
+            Node_WriteHTML(out, child);
         }
-        fprintf(out, "</h%d>\n", node->size);
+        Output_WriteText(out, "</h");
+        Output_WriteInt(out, node->size);
+        Output_WriteText(out, ">\n");
         break;
     }
     case PARAGRAPH: 
     {
-        fprintf(out, "<p>");
-        forall(elem, node->children)
+        Output_WriteText(out, "<p>");
+        for (Node* child = node->children; child; child = child->next)
         {
-            Node_WriteHTML(out, elem->data);
+            Node_WriteHTML(out, child);
         }
-        fprintf(out, "</p>\n\n");
+        Output_WriteText(out, "</p>\n\n");
         break;
     }
     case CODEBLOCK: 
     {
-        fprintf(out, "<pre><code>");
-        String_fprint(out, node->text);
-        fprintf(out, "</code></pre>\n\n");
+        Output_WriteText(out, "<pre><code>");
+        Output_WriteString(out, node->text);
+        Output_WriteText(out, "</code></pre>\n\n");
         break;
     }
     case IMAGE: 
     {
-        fprintf(out, "<img src=\"");
-        String_fprint(out, node->url);
-        fprintf(out, "\" alt=\"");
-        String_fprint(out, node->text);
-        fprintf(out, "\" />");
+        Output_WriteText(out, "<img src=\"");
+        Output_WriteString(out, node->url);
+        Output_WriteText(out, "\" alt=\"");
+        Output_WriteString(out, node->text);
+        Output_WriteText(out, "\" />");
         break;
     }
     case TEXT: 
     {
-        String_fprint(out, node->text);
+        Output_WriteString(out, node->text);
         break;
     }
     case ITALIC: 
     {
-        fprintf(out, "<em>");
-        forall(elem, node->children)
+        Output_WriteText(out, "<em>");
+        for (Node* child = node->children; child; child = child->next)
         {
-            Node_WriteHTML(out, elem->data);
+            Node_WriteHTML(out, child);
         }
-        fprintf(out, "</em>");
+        Output_WriteText(out, "</em>");
         break;
     }
     case BOLD: 
     {
-        fprintf(out, "<strong>");
-        forall(elem, node->children)
+        Output_WriteText(out, "<strong>");
+        for (Node* child = node->children; child; child = child->next)
         {
-            Node_WriteHTML(out, elem->data);
+            Node_WriteHTML(out, child);
         }
-        fprintf(out, "</strong>");
+        Output_WriteText(out, "</strong>");
         break;
     }
     case CODE: 
     {
-        fprintf(out, "<code>");
-        String_fprint(out, node->text);
-        fprintf(out, "</code>");
+        Output_WriteText(out, "<code>");
+        Output_WriteString(out, node->text);
+        Output_WriteText(out, "</code>");
         break;
     }
     case LINK: 
     {
-        fprintf(out, "<a href=\"");
-        String_fprint(out, node->url);
-        fprintf(out, "\">");
-        String_fprint(out, node->text);
-        fprintf(out, "</a>");
+        Output_WriteText(out, "<a href=\"");
+        Output_WriteString(out, node->url);
+        Output_WriteText(out, "\">");
+        Output_WriteString(out, node->text);
+        Output_WriteText(out, "</a>");
         break;
     }
     }
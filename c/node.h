@@ -1,9 +1,9 @@
 #ifndef NODE_H
 #define NODE_H
 
-#include "list.h"
+#include "arena.h"
+#include "output.h"
 #include "string.h"
-#include <stdio.h>
 
 typedef enum nodeType 
 {
@@ -18,17 +18,19 @@ typedef enum nodeType
     LINK
 } NodeType;
 
+// Children are a singly linked list through `next`, in order
 typedef struct node 
 {
     NodeType type;
     int size;
-    List* children;
+    struct node* children;
+    struct node* next;
     String text;
     String url;
 } Node;
 
-Node* Node_New(NodeType type, int size, List* children, String text, String url);
+Node* Node_New(Arena* arena, NodeType type, int size, Node* children, String text, String url);
 
-void Node_WriteHTML(FILE* out, Node* node);
+void Node_WriteHTML(Output* out, Node* node);
 
-#endif
\ No newline at end of file
+#endif
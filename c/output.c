@@ -0,0 +1,59 @@
+#include "output.h"
+#include <string.h>
+
+void Output_Init(Output* out, FILE* file)
+{
+    out->file = file;
+    out->length = 0;
+    out->failed = false;
+}
+
+void Output_Write(Output* out, const char* data, int length)
+{
+    if (out->length + length > OUTPUT_BUFFER_SIZE) 
+    {
+        Output_Flush(out);
+    }
+    // Too big to be worth copying
+    if (length > OUTPUT_BUFFER_SIZE) 
+    {
+        if (fwrite(data, 1, length, out->file) != (size_t)length) 
+        {
+            out->failed = true;
+        }
+        return;
+    }
+    memcpy(out->buffer + out->length, data, length);
+    out->length += length;
+}
+
+void Output_WriteString(Output* out, String str)
+{
+    Output_Write(out, str.data, str.length);
+}
+
+void Output_WriteText(Output* out, const char* text)
+{
+    Output_Write(out, text, strlen(text));
+}
+
+void Output_WriteInt(Output* out, int value)
+{
+    char digits[16];
+    int length = snprintf(digits, sizeof(digits), "%d", value);
+    Output_Write(out, digits, length);
+}
+
+bool Output_Flush(Output* out)
+{
+    if (out->length > 0 && fwrite(out->buffer, 1, out->length, out->file) != (size_t)out->length) 
+    {
+        out->failed = true;
+    }
+    out->length = 0;
+    if (fflush(out->file) != 0) 
+    {
+        out->failed = true;
+    }
+    return !out->failed;
+}
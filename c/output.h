@@ -0,0 +1,33 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "string.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+// Collects output in a buffer and hands it to `file` a buffer at a time, so
+// writing a node costs a few memcpys rather than a stdio call per character
+typedef struct output 
+{
+    FILE* file;
+    int length;
+    bool failed;
+    char buffer[OUTPUT_BUFFER_SIZE];
+} Output;
+
+void Output_Init(Output* out, FILE* file);
+
+void Output_Write(Output* out, const char* data, int length);
+
+void Output_WriteString(Output* out, String str);
+
+void Output_WriteText(Output* out, const char* text);
+
+void Output_WriteInt(Output* out, int value);
+
+// Writes out what's buffered. Returns false if any write has failed.
+bool Output_Flush(Output* out);
+
+#endif
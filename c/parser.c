@@ -1,17 +1,23 @@
 #include "token.h"
 #include "node.h"
 #include "parser.h"
-#include "list.h"
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
-static List* tokens;
+// The tokens are one array, so the parser can index into it directly
+static Token* tokens;
+static int tokenCount;
 static int _index;
+static Arena* arena;
 
-static List* parseFormattedText(List* bounds);
+// A set of token kinds that end a run of formatted text
+typedef unsigned Bounds;
+#define BOUND(kind) (1u << (kind))
+
+static Node* parseFormattedText(Bounds bounds);
 
 static bool isSpecialChar(char c) 
 {
@@ -26,22 +32,25 @@ static bool isSpecialChar(char c)
         c == '!';
 }
 
+// Past the end, both stay on the newline that ends the token array
 static Token* pop() 
 {
-    _index++;
-    return List_Get(tokens, _index-1);
+    Token* top = &tokens[_index];
+    if (_index < tokenCount - 1) 
+    {
+        _index++;
+    }
+    return top;
 }
 
 static Token* peek() 
 {
-    return List_Get(tokens, _index);
+    return &tokens[_index];
 }
 
-static Token* accept(char* data) 
+static Token* accept(TokenKind kind) 
 {
-    String* stringForm = String_From(data);
-    String peekToken = peek()->data;
-    if (String_Compare(&peekToken, stringForm)) 
+    if (peek()->kind == kind) 
     {
         return pop();
     } 
@@ -51,31 +60,36 @@ static Token* accept(char* data)
     }
 }
 
-static void expect(char* data) 
+static void expect(TokenKind kind) 
 {
-    if (!accept(data))
+    if (!accept(kind))
     {
         Token* top = peek();
         if (isSpecialChar(top->data.data[0]))
         {
-            fprintf(stderr, "error: %d:%d expected `%s` got ", top->line, top->col, data);
+            fprintf(stderr, "error: %d:%d expected `%s` got ", top->line, top->col, Token_Spelling(kind));
             String_fprint(stderr, top->data);
             fprintf(stderr, ".\n");
         }
         else
         {
-            fprintf(stderr, "error: %d:%d expected `%s` got text\n", top->line, top->col, data);
+            fprintf(stderr, "error: %d:%d expected `%s` got text\n", top->line, top->col, Token_Spelling(kind));
         }
         system("pause");
         exit(1);
     }
 }
 
-static String takeUntil(char* sentinel) 
+static bool atEnd() 
+{
+    return _index >= tokenCount - 1;
+}
+
+static String takeUntil(TokenKind sentinel) 
 {
     String data = peek()->data;
     data.length = 0;
-    while (!accept(sentinel)) 
+    while (!accept(sentinel) && !atEnd()) 
     {
         data.length += pop()->data.length;
     }
@@ -85,126 +99,114 @@ static String takeUntil(char* sentinel)
 static Node* parseHeader() 
 {
     int size = 1;
-    while (accept("#")) 
+    while (accept(TOKEN_HASH)) 
     {
         size++;
     }
-    List* bounds = List_Create();
-    List_Append(bounds, String_From("\n"));
-    // TODO: free bounds
-    return Node_New(HEADER, size, parseFormattedText(bounds), NO_STRING, NO_STRING);
+    return Node_New(arena, HEADER, size, parseFormattedText(BOUND(TOKEN_NEWLINE)), NO_STRING, NO_STRING);
 }
 
 static Node* parseParagraph() 
 {
-    List* bounds = List_Create();
-    List_Append(bounds, String_From("\n"));
-    // TODO: free bounds
-    return Node_New(PARAGRAPH, 0, parseFormattedText(bounds), NO_STRING, NO_STRING);
+    return Node_New(arena, PARAGRAPH, 0, parseFormattedText(BOUND(TOKEN_NEWLINE)), NO_STRING, NO_STRING);
 }
 
 static Node* parseCodeBlock() 
 {
-    return Node_New(CODEBLOCK, 0, NULL, takeUntil("```"), NO_STRING);
+    return Node_New(arena, CODEBLOCK, 0, NULL, takeUntil(TOKEN_FENCE), NO_STRING);
 }
 
 static Node* parseImage() 
 {
-    expect("[");
+    expect(TOKEN_LBRACKET);
     String text = pop()->data;
-    expect("]");
-    expect("(");
+    expect(TOKEN_RBRACKET);
+    expect(TOKEN_LPAREN);
     String url = pop()->data;
-    expect(")");
-    return Node_New(IMAGE, 0, NULL, text, url);
+    expect(TOKEN_RPAREN);
+    return Node_New(arena, IMAGE, 0, NULL, text, url);
 }
 
-static Node* parseItalic(List* bounds) 
+static Node* parseItalic(Bounds bounds) 
 {
-    List* newBounds = List_Clone(bounds);
-    List_Append(newBounds, String_From("*"));
-    List_Append(newBounds, String_From("_"));
-    List* children = parseFormattedText(newBounds);
-    // TODO: free newBounds
-    if (!accept("*")) 
+    Node* children = parseFormattedText(bounds | BOUND(TOKEN_STAR) | BOUND(TOKEN_UNDERSCORE));
+    if (!accept(TOKEN_STAR)) 
     {
-        expect("_");
+        expect(TOKEN_UNDERSCORE);
     }
-    return Node_New(ITALIC, 0, children, NO_STRING, NO_STRING);
+    return Node_New(arena, ITALIC, 0, children, NO_STRING, NO_STRING);
 }
 
-static Node* parseBold(List* bounds) 
+static Node* parseBold(Bounds bounds) 
 {
-    List* newBounds = List_Clone(bounds);
-    List_Append(newBounds, String_From("**"));
-    List_Append(newBounds, String_From("__"));
-    List* children = parseFormattedText(newBounds);
-    // TODO: free newBounds
-    if (!accept("**")) 
+    Node* children = parseFormattedText(bounds | BOUND(TOKEN_DOUBLE_STAR) | BOUND(TOKEN_DOUBLE_UNDERSCORE));
+    if (!accept(TOKEN_DOUBLE_STAR)) 
     {
-        expect("__");
+        expect(TOKEN_DOUBLE_UNDERSCORE);
     }
-    return Node_New(BOLD, 0, children, NO_STRING, NO_STRING);
+    return Node_New(arena, BOLD, 0, children, NO_STRING, NO_STRING);
 }
 
 static Node* parseCode() 
 {
-    return Node_New(CODE, 0, NULL, takeUntil("`"), NO_STRING);
+    return Node_New(arena, CODE, 0, NULL, takeUntil(TOKEN_BACKTICK), NO_STRING);
 }
 
 static Node* parseLink() 
 {
     String text = pop()->data;
-    expect("]");
-    expect("(");
+    expect(TOKEN_RBRACKET);
+    expect(TOKEN_LPAREN);
     String url = pop()->data;
-    expect(")");
-    return Node_New(LINK, 0, NULL, text, url);
+    expect(TOKEN_RPAREN);
+    return Node_New(arena, LINK, 0, NULL, text, url);
 }
 
-static List* parseFormattedText(List* bounds) 
+static Node* parseFormattedText(Bounds bounds) 
 {
-    List* retval = List_Create();
-    while (!List_Contains(bounds, &peek()->data, &String_Compare)) 
+    Node* first = NULL;
+    Node** last = &first;
+    while (!(bounds & BOUND(peek()->kind))) 
     {
-        if (accept("_") || accept("*")) 
+        if (accept(TOKEN_UNDERSCORE) || accept(TOKEN_STAR)) 
         {
-            List_Append(retval, parseItalic(bounds));
+            *last = parseItalic(bounds);
         } 
-        else if (accept("__") || accept("**")) 
+        else if (accept(TOKEN_DOUBLE_UNDERSCORE) || accept(TOKEN_DOUBLE_STAR)) 
         {
-            List_Append(retval, parseBold(bounds));
+            *last = parseBold(bounds);
         } 
-        else if (accept("`")) 
+        else if (accept(TOKEN_BACKTICK)) 
         {
-            List_Append(retval, parseCode());
+            *last = parseCode();
         } 
-        else if (accept("[")) 
+        else if (accept(TOKEN_LBRACKET)) 
         {
-            List_Append(retval, parseLink());
+            *last = parseLink();
         } else 
         {
-            List_Append(retval, Node_New(TEXT, 0, NULL, pop()->data, NO_STRING));
+            *last = Node_New(arena, TEXT, 0, NULL, pop()->data, NO_STRING);
         }
+        last = &(*last)->next;
     }
-    return retval;
+    return first;
 }
 
 static Node* parseNode() 
 {
-    if (accept("#")) 
+    if (accept(TOKEN_HASH)) 
     {
         return parseHeader();
     } 
-    else if (accept("```")) 
+    else if (accept(TOKEN_FENCE)) 
     {
         return parseCodeBlock();
     } 
-    else if (accept("!")) 
+    else if (accept(TOKEN_BANG)) 
     {
         return parseImage();
     } 
-    else if (!accept("\n")) 
+    else if (!accept(TOKEN_NEWLINE)) 
     {
         return parseParagraph();
     }
@@ -214,25 +216,28 @@ static Node* parseNode()
     }
 }
 
-List* Parser_ParseDocument() 
+Node* Parser_ParseDocument() 
 {
-    List* retval = List_Create();
-    while (_index < tokens->size - 1) 
+    Node* first = NULL;
+    Node** last = &first;
+    while (!atEnd()) 
     {
         Node* node = parseNode();
         if (node) 
         {
-            List_Append(retval, node);
+            *last = node;
+            last = &node->next;
         }
     }
-    return retval;
+    return first;
 }
 
-void Parser_Init(String contents) 
+// Splits `contents` into tokens, storing them in `out` unless it is NULL,
+// and returns how many there are. Run once to count and again to fill the
+// array, so it can be allocated at its final size.
+static int tokenize(String contents, Token* out)
 {
-    tokens = List_Create();
-    _index = 0;
-
+    int count = 0;
     String data = {contents.data, 1, 0}; // A substring
     int line = 1;
     int col = 1;
@@ -245,7 +250,11 @@ void Parser_Init(String contents)
         {
             if (!String_Contains(data, '\r'))
             {
-                List_Append(tokens, Token_New(data, line, oldCol));
+                if (out) 
+                {
+                    out[count] = (Token){data, Token_Kind(data), line, oldCol};
+                }
+                count++;
             }
             oldCol = col + 1;
             if (c == '\n')
@@ -265,8 +274,20 @@ void Parser_Init(String contents)
         col++;
         oldC = c;
     }
-    List_Append(tokens, Token_New(data, line, oldCol));
-    char* newline = malloc(1);
-    *newline = '\n';
-    List_Append(tokens, Token_New((String){newline, 1, 0}, line, oldCol));
-}
\ No newline at end of file
+    String newline = {"\n", 1, 0};
+    if (out) 
+    {
+        out[count] = (Token){data, Token_Kind(data), line, oldCol};
+        out[count + 1] = (Token){newline, TOKEN_NEWLINE, line, oldCol};
+    }
+    return count + 2;
+}
+
+void Parser_Init(String contents, Arena* memory) 
+{
+    arena = memory;
+    tokenCount = tokenize(contents, NULL);
+    tokens = Arena_Alloc(arena, tokenCount * sizeof(Token));
+    tokenize(contents, tokens);
+    _index = 0;
+}
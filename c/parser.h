@@ -1,10 +1,13 @@
 #ifndef PARSER_H
 #define PARSER_H
 
-#include "list.h"
+#include "arena.h"
+#include "node.h"
 #include "string.h"
 
-void Parser_Init(String contents);
-List* Parser_ParseDocument();
+// Tokens and nodes are allocated from `arena`, and point into `contents`
+void Parser_Init(String contents, Arena* arena);
+// Returns the first top-level block; the rest follow through `next`
+Node* Parser_ParseDocument();
 
-#endif
\ No newline at end of file
+#endif
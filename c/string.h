@@ -13,12 +13,6 @@ typedef struct
     int capacity;
 } String;
 
-String String_New();
-
-String* String_From(char* str);
-
-void String_Append(String* str, char c);
-
 bool String_Contains(String str, char c);
 
 void String_fprint(FILE* out, String str);
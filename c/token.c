@@ -1,11 +1,41 @@
 #include "token.h"
-#include <stdlib.h>
+#include <string.h>
 
-Token* Token_New(String data, int line, int col) 
+static const char* spellings[] = {
+    [TOKEN_TEXT] = "text",
+    [TOKEN_NEWLINE] = "\n",
+    [TOKEN_HASH] = "#",
+    [TOKEN_FENCE] = "```",
+    [TOKEN_BACKTICK] = "`",
+    [TOKEN_STAR] = "*",
+    [TOKEN_UNDERSCORE] = "_",
+    [TOKEN_DOUBLE_STAR] = "**",
+    [TOKEN_DOUBLE_UNDERSCORE] = "__",
+    [TOKEN_LBRACKET] = "[",
+    [TOKEN_RBRACKET] = "]",
+    [TOKEN_LPAREN] = "(",
+    [TOKEN_RPAREN] = ")",
+    [TOKEN_BANG] = "!",
+};
+
+TokenKind Token_Kind(String data) 
+{
+    if (data.length > 3) 
+    {
+        return TOKEN_TEXT;
+    }
+    for (int kind = TOKEN_NEWLINE; kind <= TOKEN_BANG; kind++) 
+    {
+        const char* spelling = spellings[kind];
+        if ((int)strlen(spelling) == data.length && memcmp(spelling, data.data, data.length) == 0) 
+        {
+            return kind;
+        }
+    }
+    return TOKEN_TEXT;
+}
+
+const char* Token_Spelling(TokenKind kind) 
 {
-    Token* retval = malloc(sizeof(Token));
-    retval->data = data;
-    retval->line = line;
-    retval->col = col;
-    return retval;
-}
\ No newline at end of file
+    return spellings[kind];
+}
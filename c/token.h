@@ -3,13 +3,37 @@
 
 #include "string.h"
 
+// What a token is, worked out once when it is made so the parser compares
+// kinds rather than strings. Anything that isn't markup is TOKEN_TEXT.
+typedef enum tokenKind 
+{
+    TOKEN_TEXT,
+    TOKEN_NEWLINE,
+    TOKEN_HASH,
+    TOKEN_FENCE,
+    TOKEN_BACKTICK,
+    TOKEN_STAR,
+    TOKEN_UNDERSCORE,
+    TOKEN_DOUBLE_STAR,
+    TOKEN_DOUBLE_UNDERSCORE,
+    TOKEN_LBRACKET,
+    TOKEN_RBRACKET,
+    TOKEN_LPAREN,
+    TOKEN_RPAREN,
+    TOKEN_BANG
+} TokenKind;
+
 typedef struct token 
 {
     String data;
+    TokenKind kind;
     int line;
     int col;
 } Token;
 
-Token* Token_New(String data, int line, int col);
+TokenKind Token_Kind(String data);
+
+// How a kind is written, for error messages
+const char* Token_Spelling(TokenKind kind);
 
-#endif
\ No newline at end of file
+#endif